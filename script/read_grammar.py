@@ -1,6 +1,6 @@
 #!/usr/bin/env python3
 
-import sys, argparse, os
+import sys, argparse, os, re
 
 import numpy as np
 
@@ -40,6 +40,19 @@ def interpreter(terminal):
       else:
          return None
 
+def arity(case):
+   """Arity (how many values are popped from the stack) of a terminal, out of
+   its case in the interpreter core: either given by a hint such as
+   "// ARITY=3" or inferred from how much the case moves 'stack_top'."""
+   body = ''.join(case)
+   hint = re.search(r'ARITY\s*=\s*(\d+)', body)
+   if hint:
+      return int(hint.group(1))
+   effect = body.count('++stack_top') + body.count('stack_top++') - body.count('--stack_top') - body.count('stack_top--')
+   for sign, n in re.findall(r'stack_top\s*=\s*stack_top\s*([+-])\s*(\d+)', body) + re.findall(r'stack_top\s*([+-])=\s*(\d+)', body):
+      effect += int(n) if sign == '+' else -int(n)
+   return 1 - effect
+
 def read_file(filename):
    try:
       f = open(filename, "r")
@@ -278,6 +291,17 @@ symbol_head = r"""#ifndef __SYMBOL_H
 typedef enum {"""
 
 symbol_tail = r"""} Symbol;
+
+/* A program is a sequence of 32-bit instructions: the lower 16 bits are the
+   opcode (the Symbol) and the upper 16 bits an inline operand, which is the
+   attribute index of a T_ATTRIBUTE and, for a T_CONST, the index of its value
+   in the program's constant pool (stored right after the instructions). */
+typedef unsigned int Instruction;
+
+#define INSTRUCTION( opcode, operand ) ( ((unsigned int) (operand) << 16) | (unsigned int) (opcode) )
+#define OPCODE( instruction ) ( (Symbol) ((instruction) & 0xFFFF) )
+#define OPERAND( instruction ) ( (int) ((instruction) >> 16) )
+#define MAX_OPERAND 0xFFFF
 """
 
 
@@ -286,33 +310,50 @@ if "T_CONST" not in text5:
 #define NOT_USING_T_CONST 1
 """
 
-symbol_tail = symbol_tail + r"""
-#endif"""
-
-
-f = open(os.path.join(args.output_dir, "symbol"), 'w')
-#f.write(symbol_head + text4 + text5 + text7 + symbol_tail)
-f.write(symbol_head + text4 + text5 + text6 + symbol_tail)
-f.close()
-
 lines = read_file(args.interpreter)
 lst = list(text5.split())
 lst = [s.replace(',', '') for s in lst]
 
-core = []; terminais = [];
+core = []; core_block = []; terminais = []; arities = {};
 index = [i for i, j in enumerate(lines) if 'case' in j]
 for i in range(0,len(index)):
    terminais.append(lines[index[i]].split('case ')[1].split(':')[0])
    if lines[index[i]].split('case ')[1].split(':')[0] in lst:
       if i+1 > len(index)-1:
-         core += lines[index[i]:len(lines)]
+         case = lines[index[i]:len(lines)]
       else:
-         core += lines[index[i]:index[i+1]]
+         case = lines[index[i]:index[i+1]]
+      core += case
+      arities[case[0].split('case ')[1].split(':')[0].strip()] = arity(case)
+      # Block version (see sequential.cc): the body of the case is run for each
+      # row (lane) of the block; its final 'break' just leaves the lane's body
+      core_block += [case[0], "SEQ_BLOCK_BEGIN\n"] + case[1:] + ["SEQ_BLOCK_END\n", "   break;\n"]
+
+# Arities of the terminals (the ones not given are leaves, such as the
+# attributes and the constants), used to work out the depth of the stack
+arity_text = ''.join(" (symbol) == " + t + " ? " + str(n) + " :" for t, n in arities.items() if n != 0)
+symbol_tail = symbol_tail + r"""
+/* Arity of each symbol, i.e., how many values it pops from the stack */
+#define ARITY( symbol ) (""" + arity_text + """ 0 )
+"""
+
+symbol_tail = symbol_tail + r"""
+#endif"""
+
+
+f = open(os.path.join(args.output_dir, "symbol"), 'w')
+#f.write(symbol_head + text4 + text5 + text7 + symbol_tail)
+f.write(symbol_head + text4 + text5 + text6 + symbol_tail)
+f.close()
 
 f = open(os.path.join(args.output_dir, "interpreter_core"), 'w')
 f.write(''.join(core))
 f.close()
 
+f = open(os.path.join(args.output_dir, "interpreter_core_block"), 'w')
+f.write(''.join(core_block))
+f.close()
+
 #lst -> contem os terminais fornecidos pela gramatica bnf
 #terminais -> contem os terminais tratados no algoritmo (interpreter_core)
 lst = [i for i in lst if not "=" in i]
@@ -340,11 +381,11 @@ for i in range(0,len(index)):
 
 icp_header = r"""void ppi_individual_print( const Population* individual, int idx, FILE* out, int generation, int argc, char** argv, int print_mode )
 {
-   Symbol phenotype[data.max_size_phenotype];
-   float ephemeral[data.max_size_phenotype];
+   Instruction program[data.max_size_phenotype];
+   float constants[data.max_size_phenotype];
 
-   int allele = 0;
-   int size = decode( individual->genome[idx], &allele, phenotype, ephemeral, 0, data.initial_symbol );
+   int allele = 0, num_constants = 0;
+   int size = decode( individual->genome[idx], &allele, program, constants, &num_constants, 0, data.initial_symbol );
    if( !size ) { return; }
 
    if (print_mode)
@@ -353,13 +394,13 @@ icp_header = r"""void ppi_individual_print( const Population* individual, int id
       fprintf( out, "\n[%d] %3d :: %.12f :: ", generation, size, individual->fitness[idx] - ALPHA*size ); // Print the raw error, that is, without the penalization for complexity
 
    for( int i = 0; i < size; ++i )
-      switch( phenotype[i] )
+      switch( OPCODE( program[i] ) )
       {
 """
 
 icp_tail = r"""
          case T_ATTRIBUTE:
-            fprintf( out, "ATTR-%d ", (int)ephemeral[i] );
+            fprintf( out, "ATTR-%d ", OPERAND( program[i] ) );
             break;
       }
 
@@ -368,18 +409,19 @@ icp_tail = r"""
       fprintf(out, ";");
       for( int i = 0; i < size; ++i )
 
-         if(
 #ifndef NOT_USING_T_CONST
-         phenotype[i] == T_CONST ||
+         if( OPCODE( program[i] ) == T_CONST )
+            fprintf( out, "%d %.12f ", T_CONST, constants[OPERAND( program[i] )] );
+         else
 #endif
-         phenotype[i] == T_ATTRIBUTE )
-            fprintf( out, "%d %.12f ", phenotype[i], ephemeral[i] );
+         if( OPCODE( program[i] ) == T_ATTRIBUTE )
+            fprintf( out, "%d %.12f ", T_ATTRIBUTE, (float) OPERAND( program[i] ) );
          else
-            fprintf( out, "%d ", phenotype[i] );
+            fprintf( out, "%d ", OPCODE( program[i] ) );
       // Print the individual's genome, but only the active (no introns) region (useful for seeding new generations)
       fprintf(out, ";");
       for(int i=0; i<allele; ++i)
-         fprintf(out, "%d", (individual->genome[idx])[i]);
+         fprintf(out, "%d", genome_get( individual->genome[idx], i ));
       fprintf(out, ";");
       for (int i=0; i<argc; ++i)
          fprintf(out, "%s ", argv[i]);
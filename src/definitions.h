@@ -16,6 +16,9 @@
 /* The macro ERROR(X,Y) will be replaced with the function defined by
  * '-DEF=function' at building time. */
 #define ERROR(X,Y) @EF@
+/* The definitions of the error function and cost matrix as strings; together
+ * they identify the fitness function (e.g. to tag persisted fitness values). */
+#define ERROR_STRING "@EF@" "@COST@"
 /* This will be either '#define REDUCEMAX 1' or nothing, dependeing whether
  * this option was given at building time. */
 #cmakedefine REDUCEMAX 1
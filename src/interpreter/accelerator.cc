@@ -19,11 +19,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <cmath> 
 #include <limits>
+#include <cstring>
 #include <string>   
 #include <vector>
 #include <utility>
+#include <algorithm>
 #include <iostream> 
 #include <fstream> 
 #include "accelerator.h"
@@ -53,7 +56,12 @@ std::string getAbsoluteDirectory(std::string filepath) {
 /** ***************************** TYPES ****************************** **/
 /** ****************************************************************** **/
 
-namespace ppi { static struct t_data { int max_size; int max_arity; int nlin; int population_size; unsigned local_size1; unsigned global_size1; unsigned local_size2; unsigned global_size2; std::string strategy; cl::Device device; cl::Context context; cl::Kernel kernel1; cl::Kernel kernel2; cl::CommandQueue queue; cl::Buffer buffer_phenotype; cl::Buffer buffer_ephemeral; cl::Buffer buffer_size; cl::Buffer buffer_inputs; cl::Buffer buffer_vector; cl::Buffer buffer_error; cl::Buffer buffer_pb; cl::Buffer buffer_pi; double gpops_gen_kernel; double gpops_gen_communication; double time_gen_kernel1; double time_gen_kernel2; double time_gen_communication_send1; double time_gen_communication_send2; double time_gen_communication_receive1; double time_gen_communication_receive2; double time_total_kernel1; double time_total_kernel2; double time_communication_dataset; double time_total_communication_send1; double time_total_communication_send2; double time_total_communication_receive1; double time_total_communication_receive2; double time_total_communication1; std::string executable_directory; bool verbose; bool transpose; } data; };
+/* One of the devices among which the population is split (see -cl-d and
+   interpret_devices): each one has its own context, queue, evaluation kernel,
+   copy of the dataset and buffers, and evaluates the slice [begin, end). */
+struct t_device { cl::Device device; cl::Context context; cl::CommandQueue queue; cl::Program program; cl::Kernel kernel; unsigned local_size; unsigned global_size; int num_partials; cl::Buffer inputs; cl::Buffer program_buffer; cl::Buffer offset; cl::Buffer size; cl::Buffer vector; unsigned capacity; int begin; int end; double work; double rate; std::vector<int> rebased; std::vector<float> errors; cl::Event sent; cl::Event done; };
+
+namespace ppi { static struct t_data { int max_size; int max_arity; int nlin; int population_size; unsigned local_size1; unsigned global_size1; unsigned local_size2; unsigned global_size2; std::string strategy; cl::Device device; cl::Context context; cl::Program program; cl::Kernel kernel1; cl::Kernel kernel_pp; unsigned local_size_pp; cl::Kernel kernel2; cl::Kernel kernel_reduce; cl::Kernel kernel_decode; cl::CommandQueue queue; cl::CommandQueue transfer_queue; cl::CommandQueue hybrid_queue; int hybrid_threshold; int hybrid_direction; double hybrid_cost; std::vector<int> hybrid_order; std::vector<int> hybrid_offset; std::vector<int> hybrid_size; cl::Buffer buffer_program; cl::Buffer buffer_offset; cl::Buffer buffer_size; unsigned program_capacity; cl::Buffer staging_program; cl::Buffer staging_offset; cl::Buffer staging_size; Instruction* staged_program; int* staged_offset; int* staged_size; unsigned staging_capacity; bool zero_copy; cl::Buffer buffer_genomes; cl::Buffer buffer_grammar; cl::Buffer buffer_length; int number_of_words; int slot_size; unsigned local_size_decode; cl::Kernel kernel_generate; cl::Kernel kernel_breed; cl::Kernel kernel_fitness; cl::Buffer buffer_population[2]; cl::Buffer buffer_population_fitness[2]; cl::Buffer buffer_population_length[2]; cl::Buffer buffer_neutral; cl::Buffer buffer_rng; int current; unsigned local_size_evolve; std::vector<cl::Buffer> buffer_batch_program; std::vector<cl::Buffer> buffer_batch_offset; std::vector<cl::Buffer> buffer_batch_size; std::vector<cl::Buffer> buffer_batch_vector; std::vector<unsigned> batch_capacity; std::vector<unsigned> batch_vector_capacity; std::vector<int> batch_nInd; std::vector<int> batch_partials; std::vector< std::vector<float> > batch_errors; std::vector<cl::Event> batch_done; cl::Buffer buffer_inputs; cl::Buffer buffer_vector; cl::Buffer buffer_error; cl::Buffer buffer_candidates; bool fused; cl::Buffer buffer_best; int input_stride; double gpops_gen_kernel; double gpops_gen_communication; double time_gen_kernel1; double time_gen_kernel2; double time_gen_communication_send1; double time_gen_communication_send2; double time_gen_communication_receive1; double time_gen_communication_receive2; double time_total_kernel1; double time_total_kernel2; double time_communication_dataset; double time_total_communication_send1; double time_total_communication_send2; double time_total_communication_receive1; double time_total_communication_receive2; double time_total_communication1; std::string executable_directory; bool verbose; bool transpose; int ncol; std::string kernel_source; std::string build_options; std::vector< std::pair<int,int> > device_list; int max_local_size; std::vector<t_device> devices; bool autotune; std::string tuning_file; std::string tuning_key; std::string binary_cache; int stack_depth; std::string variant_source; std::vector<cl::Program> variant_program; std::vector<unsigned> variant_depth; std::vector<cl::Kernel> variant_kernel; } data; };
 
 namespace ppi {
 
@@ -187,119 +195,94 @@ int opencl_init( int platform_id, int device_id, cl_device_type type )
 
    data.context = cl::Context( devices );
 
-   data.queue = cl::CommandQueue( data.context, data.device
+   /* When the device shares the memory with the host (e.g. CPUs, integrated
+      GPUs), the kernels can read the host's staging buffers in place. This
+      query is deprecated in OpenCL 2.0, hence the C API. */
+   cl_bool unified = CL_FALSE;
+   clGetDeviceInfo( data.device(), CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof( cl_bool ), &unified, NULL );
+   data.zero_copy = unified == CL_TRUE;
+
+   // The HYBRID strategy times its kernels (see adapt_threshold)
+   cl_command_queue_properties properties = data.strategy == "HYBRID" ? CL_QUEUE_PROFILING_ENABLE : 0;
 #ifdef PROFILING
-   , CL_QUEUE_PROFILING_ENABLE 
+   properties = CL_QUEUE_PROFILING_ENABLE;
 #endif
-   );
+   data.queue = cl::CommandQueue( data.context, data.device, properties );
+
+   /* A second queue just for the transfers of the batches (see acc_submit),
+      so that they can overlap with the kernels of the main queue */
+   data.transfer_queue = cl::CommandQueue( data.context, data.device );
+
+   // With HYBRID, the PP kernel runs on its own queue, alongside the PDP one
+   if( data.strategy == "HYBRID" )
+   {
+      data.hybrid_queue = cl::CommandQueue( data.context, data.device, CL_QUEUE_PROFILING_ENABLE );
+   }
 
 
    return 0;
 }
 
 // -----------------------------------------------------------------------------
-int build_kernel( int maxlocalsize, int ppp_mode, int prediction_mode )
+/* Largest local size of the evaluation kernels (kernel1) on 'device': the
+   given one, if any, otherwise what the device allows */
+unsigned max_evaluation_local_size( const cl::Device& device, int maxlocalsize )
 {
-   unsigned max_stack_size;
-   if( ppp_mode && prediction_mode ) 
-   {
-      max_stack_size = data.max_size;
-   }
-   else
-   {
-      /*
-         In practice we don't need 'max_stack_size' to be equal to 'data.max_size',
-         we can lower this and then save memory on the device. The formula below gives us
-         the upper bound for stack use:
-
-         /                           |            MTS             | \
-         stack size = max|  1, MTS - |  ------------------------  |  |
-         |                           |       /               \    |  |
-         |                           |   min| arity max, MTS  |   |  |
-         \                           |_      \               /   _| /
+   if( maxlocalsize > 0 ) return maxlocalsize;
 
-         where MTS is data.max_size().
-       */
-      max_stack_size = std::max( 1U, (unsigned)( data.max_size -
-               std::floor(data.max_size /
-                  (float) std::min( data.max_arity, data.max_size ) ) ) );
-   }
+   unsigned max_local_size1 = fmin( device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>(), device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>()[0] );
 
-   /* Use a prefix (the given label) to minimize the likelihood of collisions
-    * when two or more problems are built into the same build directory.
-      The directory of the executable binary is prefixed here so that OpenCL
-      will find the kernels regardless of user's current directory. */
-   std::string opencl_file = data.executable_directory + std::string(std::string(xstr(LABEL)) + "-accelerator.cl");
-   ifstream file(opencl_file.c_str());
-   string kernel_str( istreambuf_iterator<char>(file), ( istreambuf_iterator<char>()) );
+   //It is necessary to respect the local memory size. Depending on the
+   //maximum local size, there will not be enough space to allocate the
+   //local variables.  The local size depends on the maximum local size. 
+   //The division by 4: 1 local vector in the DP and PDP kernels (both are float vectors, so the division by 4 bytes)
+   return fmin( max_local_size1, device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / 4 );
+}
 
-   
-   string program_str;
-   if (data.transpose)
-   {
-      program_str = 
-         "#define TRANSPOSE 1 \n #define MAX_STACK_SIZE " + util::ToString( max_stack_size ) + "\n" +
-         "#define MAX_PHENOTYPE_SIZE " + util::ToString( data.max_size ) + "\n" +
-         kernel_str;
-   }
-   else
-   {
-      program_str = 
-         "#define MAX_STACK_SIZE " + util::ToString( max_stack_size ) + "\n" +
-         "#define MAX_PHENOTYPE_SIZE " + util::ToString( data.max_size ) + "\n" +
-         kernel_str;
-   }
-   //cerr << program_str << endl;
+/* Local size of the evaluation kernel of the current strategy on 'device'
+   (HYBRID is PDP here) */
+unsigned evaluation_local_size( const cl::Device& device, unsigned max_local_size1 )
+{
+   const unsigned max_cu = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
 
-   cl::Program::Sources source( 1, program_str );
+   if( data.strategy == "PP" ) // Evenly distribute the individuals among the compute units
+      return fmin( max_local_size1, (unsigned) ceil( data.population_size/(float) max_cu ) );
+   if( data.strategy == "DP" ) // Evenly distribute the points among the compute units
+      return fmin( max_local_size1, (unsigned) ceil( data.nlin/(float) max_cu ) );
+   return data.nlin < max_local_size1 ? data.nlin : max_local_size1; // PDP: the points of one individual
+}
 
-   cl::Program program( data.context, source );
+/* Whether the evaluation kernel (kernel1) is the fused one, which also keeps
+   the key of the best individual in 'buffer_best' (-fused; PP and PDP only) */
+bool fusing()
+{
+   return data.fused && (data.strategy == "PP" || data.strategy == "PDP");
+}
 
-   vector<cl::Device> device; device.push_back( data.device );
-   try {
-      /* Pass the following definition to the OpenCL compiler:
-            -I<executable_absolute_directory>/INCLUDE_RELATIVE_DIR
-         where <executable_absolute_directory> is the current directory
-         of the executable binary and INCLUDE_RELATIVE_DIR is a relative
-         subdirectory where the assembled source files will be put by CMake. */
-      std::string flags = std::string(" -I" + data.executable_directory + std::string(xstr(INCLUDE_RELATIVE_DIR)));
-      program.build( device, flags.c_str() );
-   }
-   catch( cl::Error& e )
-   {
-      cerr << "Build Log:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(data.device) << std::endl;
-      throw;
-   }
+// -----------------------------------------------------------------------------
+/* Creates the kernels of the current strategy out of the built program and
+   works out their local and global sizes; it can be called again, with
+   another strategy or maximum local size, as long as create_result_buffers
+   follows (the autotuner does so). */
+int setup_kernels( int maxlocalsize, int ppp_mode )
+{
+   const cl::Program& program = data.program;
 
    unsigned max_cu = data.device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
-   unsigned max_local_size1, max_local_size2;
-   if( maxlocalsize > 0 )
-   {
-      max_local_size1 = maxlocalsize;
-   }
-   else 
-   {
-      max_local_size1 = fmin( data.device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>(), data.device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>()[0] );
-   
-      //It is necessary to respect the local memory size. Depending on the
-      //maximum local size, there will not be enough space to allocate the
-      //local variables.  The local size depends on the maximum local size. 
-      //The division by 4: 1 local vector in the DP and PDP kernels (both are float vectors, so the division by 4 bytes)
-      max_local_size1 = fmin( max_local_size1, data.device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / 4 );
-   }
+   unsigned max_local_size1 = max_evaluation_local_size( data.device, maxlocalsize ), max_local_size2;
 
    max_local_size2 = fmin( data.device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>(), data.device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>()[0] );
    //It is necessary to respect the local memory size. Depending on the
    //maximum local size, there will not be enough space to allocate the
    //local variables.  The local size depends on the maximum local size. 
-   //The division by 8: 2 local vectors in best_individual kernel * 4 bytes
+   //The division by 8: 1 local vector of (64-bit) keys in best_individuals kernel
    max_local_size2 = fmin( max_local_size2, data.device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / 8 );
 
    if( data.strategy == "PP" )  // Population-parallel
    {
-      data.local_size1 = fmin( max_local_size1, (unsigned) ceil( data.population_size/(float) max_cu ) );
+      data.local_size1 = evaluation_local_size( data.device, max_local_size1 );
       data.global_size1 = (unsigned) ( ceil( data.population_size/(float) data.local_size1 ) * data.local_size1 );
-      data.kernel1 = cl::Kernel( program, "evaluate_pp" );
+      data.kernel1 = cl::Kernel( program, fusing() ? "evaluate_pp_best" : "evaluate_pp" );
    }
    else
    {
@@ -307,37 +290,48 @@ int build_kernel( int maxlocalsize, int ppp_mode, int prediction_mode )
       {
          // Evenly distribute the workload among the compute units (but avoiding local size
          // being more than the maximum allowed).
-         data.local_size1 = fmin( max_local_size1, (unsigned) ceil( data.nlin/(float) max_cu ) );
+         data.local_size1 = evaluation_local_size( data.device, max_local_size1 );
 
          // It is better to have global size divisible by local size
          data.global_size1 = (unsigned) ( ceil( data.nlin/(float) data.local_size1 ) * data.local_size1 );
          data.kernel1 = cl::Kernel( program, "evaluate_dp" );
+         // Second stage: the partial errors of each individual into its fitness
+         data.kernel_reduce = cl::Kernel( program, "reduce_dp" );
       }
       else
       {
-         if( data.strategy == "PDP" ) // Population-parallel computing unit
+         if( data.strategy == "PDP" || data.strategy == "HYBRID" ) // Population-parallel computing unit
          {
-            if( data.nlin < max_local_size1 )
-            {
-               data.local_size1 = data.nlin;
-            }
-            else
-            {
-               data.local_size1 = max_local_size1;
-            }
+            data.local_size1 = evaluation_local_size( data.device, max_local_size1 );
             //data.local_size1 = 128;
             // One individual per work-group
             data.global_size1 = data.population_size * data.local_size1;
-            data.kernel1 = cl::Kernel( program, "evaluate_pdp" );
+            data.kernel1 = cl::Kernel( program, fusing() ? "evaluate_pdp_best" : "evaluate_pdp" );
+
+            /* HYBRID: the short programs go to the PP kernel instead (see
+               acc_interpret); the threshold starts at a few instructions */
+            if( data.strategy == "HYBRID" )
+            {
+               data.local_size_pp = fmin( max_local_size1, (unsigned) ceil( data.population_size/(float) max_cu ) );
+               data.kernel_pp = cl::Kernel( program, "evaluate_pp" );
+               data.hybrid_threshold = std::min( 32, data.max_size );
+               data.hybrid_direction = 1;
+               data.hybrid_cost = std::numeric_limits<double>::max();
+            }
          }
          else
          {
-            fprintf(stderr, "Valid strategy: PP, DP and PDP.\n");
+            fprintf(stderr, "Valid strategy: PP, DP, PDP and HYBRID.\n");
             return 1;
          }
       }
    }
 
+   /* kernel1 of each variant (see build_kernel), the last one being the full
+      one; the others are created on first use (see select_variant) */
+   data.variant_kernel.assign( data.variant_depth.size() - 1, cl::Kernel() );
+   data.variant_kernel.push_back( data.kernel1 );
+
    if (data.verbose) {
       std::cout << "\nDevice: " << data.device.getInfo<CL_DEVICE_NAME>() << ", Compute units: " << max_cu << ", Max local size 1 (DP and PDP kernels): " << max_local_size1 << ", Max local size 2 (best kernel): " << max_local_size2 << std::endl;
       std::cout << "Local size: " << data.local_size1 << ", Global size: " << data.global_size1 << ", Work groups: " << data.global_size1/data.local_size1 << std::endl;
@@ -348,9 +342,18 @@ int build_kernel( int maxlocalsize, int ppp_mode, int prediction_mode )
       // Evenly distribute the workload among the compute units (but avoiding local size
       // being more than the maximum allowed).
       data.local_size2 = fmin( max_local_size2, (unsigned) ceil( data.population_size/(float) max_cu ) );
+      // The bitonic sort of best_individuals needs a power of two
+      while( data.local_size2 & (data.local_size2 - 1) ) data.local_size2 &= data.local_size2 - 1;
       // It is better to have global size divisible by local size
       data.global_size2 = (unsigned) ( ceil( data.population_size/(float) data.local_size2 ) * data.local_size2 );
-      data.kernel2 = cl::Kernel( program, "best_individual" );
+      data.kernel2 = cl::Kernel( program, "best_individuals" );
+      data.kernel_decode = cl::Kernel( program, "decode" );
+      data.kernel_generate = cl::Kernel( program, "generate" );
+      data.kernel_breed = cl::Kernel( program, "breed" );
+      data.kernel_fitness = cl::Kernel( program, "fitness" );
+
+      // One individual per work-item, evenly distributed among the compute units
+      data.local_size_decode = std::min( (unsigned) data.kernel_decode.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>( data.device ), (unsigned) ceil( data.population_size/(float) max_cu ) );
       if (data.verbose) {
          std::cout << "Local size: " << data.local_size2 << ", Global size: " << data.global_size2 << ", Work groups: " << data.global_size2/data.local_size2 << std::endl;
       }
@@ -361,124 +364,205 @@ int build_kernel( int maxlocalsize, int ppp_mode, int prediction_mode )
 }
 
 // -----------------------------------------------------------------------------
-
-void create_buffers( float** input, int ncol, int ppp_mode, int prediction_mode )
+/* File of the binary cache (see build_program) of the given build: its name
+   carries a hash (64-bit FNV-1a) of everything the binary depends on, i.e.,
+   the final source, the build options, the files included by the kernels and
+   the device (name and driver version). Empty if there is no cache. */
+std::string program_cache_file( const cl::Device& device, const std::string& source, const std::string& options )
 {
-#ifdef PROFILING
-   std::vector<cl::Event> events(2); 
-#endif
+   if( data.binary_cache.empty() ) return "";
 
-   // Buffer (memory on the device) of training points (input, model and obs)
-   data.buffer_inputs = cl::Buffer( data.context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, data.nlin * ncol * sizeof( float ) );
+   std::string key = source + '\0' + options + '\0' + device.getInfo<CL_DEVICE_NAME>() + '\0' + device.getInfo<CL_DRIVER_VERSION>() + '\0';
+   const char* includes[] = { "symbol", "definitions.h", "functions.h", "costmatrix", "interpreter_core" };
+   for( unsigned i = 0; i < sizeof( includes ) / sizeof( includes[0] ); ++i )
+   {
+      ifstream file( (data.executable_directory + xstr(INCLUDE_RELATIVE_DIR) + "/" + includes[i]).c_str(), std::ios::binary );
+      key += string( istreambuf_iterator<char>( file ), ( istreambuf_iterator<char>() ) ) + '\0';
+   }
 
-   float* inputs = (float*) data.queue.enqueueMapBuffer( data.buffer_inputs, CL_TRUE, CL_MAP_WRITE, 0, data.nlin * ncol * sizeof( float ), NULL
-#ifdef PROFILING
-   , &events[0]
-#endif
-   );
+   unsigned long long h = 0xCBF29CE484222325ULL;
+   for( size_t i = 0; i < key.size(); ++i ) { h ^= (unsigned char) key[i]; h *= 0x100000001B3ULL; }
 
+   char name[32]; snprintf( name, sizeof( name ), "-%016llx.bin", h );
+   return data.binary_cache + xstr(LABEL) + name;
+}
 
-   if (data.transpose)
+/* Saves the binary of the (built) 'program' into 'file'. It is written aside
+   and then renamed, since other islands may be reading the same file. */
+void save_program( const cl::Program& program, const std::string& file )
+{
+   const cl::Program::Binaries binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+   if( binaries.empty() || binaries[0].empty() ) return;
+
+   const std::string tmp = file + "." + util::ToString( getpid() );
+   ofstream out( tmp.c_str(), std::ios::binary );
+   out.write( (const char*) &binaries[0][0], binaries[0].size() ); out.close();
+   if( !out || rename( tmp.c_str(), file.c_str() ) ) remove( tmp.c_str() );
+}
+
+/* Builds the kernels of 'source' for 'device'. The binary is taken from the
+   cache (-cl-cache) when there is one for this very build; otherwise (or if
+   the device refuses it) the source is built and the binary saved. */
+cl::Program build_program( const cl::Context& context, const cl::Device& device, const std::string& source, const std::string& options )
+{
+   const vector<cl::Device> devices( 1, device );
+   const std::string file = program_cache_file( device, source, options );
+
+   ifstream cached( file.c_str(), std::ios::binary );
+   if( !file.empty() && cached )
    {
-      // Transposed version for coalesced access on the GPU
-      /*
-      TRANSPOSITION (for coalesced access on the GPU)
-
-                                 Transformed and linearized data points
-                                 +----------++----------+   +----------+
-                                 | 1 2     q|| 1 2     q|   | 1 2     q|
-           +-------------------> |X X ... X ||X X ... X |...|X X ... X |
-           |                     | 1 1     1|| 2 2     2|   | p p     p|
-           |                     +----------++----------+   +----------+
-           |                                ^             ^
-           |    ____________________________|             |
-           |   |       ___________________________________|
-           |   |      |
-         +--++--+   +--+
-         | 1|| 1|   | 1|
-         |X ||X |...|X |
-         | 1|| 2|   | p|
-         |  ||  |   |  |
-         | 2|| 2|   | 2|
-         |X ||X |...|X |
-         | 1|| 2|   | p|
-         |. ||. |   |. |
-         |. ||. |   |. |
-         |. ||. |   |. |
-         | q|| q|   | q|
-         |X ||X |...|X |
-         | 1|| 2|   | p|
-         +--++--+   +--+
-      Original data points
-
-      */
-      for( int i = 0; i < data.nlin; i++ )
-      {
-         for( int j = 0; j < ncol; j++ )
-         {
-            inputs[j * data.nlin + i] = input[i][j];
-         }
+      const std::vector<unsigned char> binary( ( istreambuf_iterator<char>( cached ) ), istreambuf_iterator<char>() );
+      try {
+         cl::Program program( context, devices, cl::Program::Binaries( 1, binary ) );
+         program.build( devices, options.c_str() );
+         if( data.verbose ) std::cout << "Kernels loaded from '" << file << "'" << std::endl;
+         return program;
       }
+      catch( cl::Error& ) {} // Stale or foreign binary: built from the source
+   }
+
+   cl::Program program( context, cl::Program::Sources( 1, source ) );
+   try {
+      program.build( devices, options.c_str() );
+   }
+   catch( cl::Error& e )
+   {
+      cerr << "Build Log:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+      throw;
+   }
+   if( !file.empty() ) save_program( program, file );
+
+   return program;
+}
+
+// -----------------------------------------------------------------------------
+int build_kernel( int maxlocalsize, int ppp_mode, int prediction_mode )
+{
+   unsigned max_stack_size;
+   if( ppp_mode && prediction_mode ) 
+   {
+      max_stack_size = data.max_size;
    }
    else
    {
-      for( int i = 0; i < data.nlin; i++ )
-      {
-         for( int j = 0; j < ncol; j++ )
-         {
-            inputs[i * ncol + j] = input[i][j];
-         }
-      }
+      /*
+         In practice we don't need 'max_stack_size' to be equal to 'data.max_size',
+         we can lower this and then save memory on the device. The formula below gives us
+         the upper bound for stack use:
+
+         /                           |            MTS             | \
+         stack size = max|  1, MTS - |  ------------------------  |  |
+         |                           |       /               \    |  |
+         |                           |   min| arity max, MTS  |   |  |
+         \                           |_      \               /   _| /
+
+         where MTS is data.max_size().
+       */
+      max_stack_size = std::max( 1U, (unsigned)( data.max_size -
+               std::floor(data.max_size /
+                  (float) std::min( data.max_arity, data.max_size ) ) ) );
    }
 
-   //if( data.strategy == "PP" ) 
-   //{
-   //   for( int i = 0; i < data.nlin; i++ )
-   //   {
-   //      for( int j = 0; j < ncol; j++ )
-   //      {
-   //         inputs[i * ncol + j] = input[i][j];
-   //      }
-   //   }
-   //}
-   //else
-   //{
-   //   if( data.strategy == "DP" || data.strategy == "PDP" ) 
-   //   {
-   //      for( int i = 0; i < data.nlin; i++ )
-   //      {
-   //         for( int j = 0; j < ncol; j++ )
-   //         {
-   //            inputs[j * data.nlin + i] = input[i][j];
-   //         }
-   //      }
-   //   }
-   //   else
-   //   {
-   //      fprintf(stderr, "Valid strategy: PP, DP and PDP.\n");
-   //   }
-   //}
+   /* Use a prefix (the given label) to minimize the likelihood of collisions
+    * when two or more problems are built into the same build directory.
+      The directory of the executable binary is prefixed here so that OpenCL
+      will find the kernels regardless of user's current directory. */
+   std::string opencl_file = data.executable_directory + std::string(std::string(xstr(LABEL)) + "-accelerator.cl");
+   ifstream file(opencl_file.c_str());
+   string kernel_str( istreambuf_iterator<char>(file), ( istreambuf_iterator<char>()) );
 
-   // Unmapping
-   data.queue.enqueueUnmapMemObject( data.buffer_inputs, inputs, NULL
-#ifdef PROFILING
-   , &events[1]
-#endif
-   );
+   
+   /* Sizes used by the decode kernel: the number of symbols of the largest
+      rule and the maximum number of pending symbols while decoding. */
+   const int max_rule_size = std::max( data.max_arity, 1 );
+   const std::string decode_str =
+      "#define MAX_RULE_SIZE " + util::ToString( max_rule_size ) + "\n" +
+      "#define MAX_DECODE_STACK_SIZE " + util::ToString( data.max_size + max_rule_size ) + "\n";
+
+   // Everything but the size of the stack, which is prepended to each build
+   string common_str;
+   if (data.transpose)
+   {
+      common_str = 
+         "#define TRANSPOSE 1 \n #define INPUT_STRIDE " + util::ToString( data.input_stride ) + "\n" +
+         "#define MAX_PHENOTYPE_SIZE " + util::ToString( data.max_size ) + "\n" +
+         decode_str + kernel_str;
+   }
+   else
+   {
+      common_str = 
+         "#define MAX_PHENOTYPE_SIZE " + util::ToString( data.max_size ) + "\n" +
+         decode_str + kernel_str;
+   }
+   const string program_str = "#define MAX_STACK_SIZE " + util::ToString( max_stack_size ) + "\n" + common_str;
+   //cerr << program_str << endl;
+   data.kernel_source = program_str; // Also built for the other devices (see devices_init)
+
+   /* Pass the following definition to the OpenCL compiler:
+         -I<executable_absolute_directory>/INCLUDE_RELATIVE_DIR
+      where <executable_absolute_directory> is the current directory
+      of the executable binary and INCLUDE_RELATIVE_DIR is a relative
+      subdirectory where the assembled source files will be put by CMake. */
+   std::string flags = std::string(" -I" + data.executable_directory + std::string(xstr(INCLUDE_RELATIVE_DIR)));
+   data.build_options = flags;
+   data.program = build_program( data.context, data.device, program_str, flags );
+
+   /* The bound above is seldom reached: the programs of a generation usually
+      need a much smaller stack (see acc_stack_depth), which spares private
+      memory. So the evaluation kernels may also be built with a few smaller
+      stacks (variants); the smallest one that fits is used each time. They
+      are built only when first needed (see select_variant), so that the
+      start-up pays for the full one only. */
+   data.variant_depth.clear();
+   if( !ppp_mode )
+   {
+      const unsigned depths[] = { 8, 32 };
+      for( unsigned d = 0; d < sizeof( depths ) / sizeof( depths[0] ) && depths[d] < max_stack_size; ++d )
+         data.variant_depth.push_back( depths[d] );
+   }
+   data.variant_source = common_str;
+   data.variant_program.assign( data.variant_depth.size(), cl::Program() );
+   data.variant_program.push_back( data.program ); data.variant_depth.push_back( max_stack_size );
+   data.stack_depth = 0;
 
-   //inputs = (float*) data.queue.enqueueMapBuffer( data.buffer_inputs, CL_TRUE, CL_MAP_READ, 0, data.nlin * ncol * sizeof( float ) );
-   //for( int i = 0; i < data.nlin * ncol; i++ )
-   //{
-   //   if( i % data.nlin == 0 ) fprintf(stdout,"\n");
-   //   fprintf(stdout,"%f ", inputs[i]);
-   //}
-   //data.queue.enqueueUnmapMemObject( data.buffer_inputs, inputs ); 
+   return setup_kernels( maxlocalsize, ppp_mode );
+}
 
-   // Buffer (memory on the device) of the programs
-   data.buffer_phenotype = cl::Buffer( data.context, CL_MEM_READ_ONLY, data.max_size * data.population_size * sizeof( Symbol ) );
-   data.buffer_ephemeral = cl::Buffer( data.context, CL_MEM_READ_ONLY, data.max_size * data.population_size * sizeof( float ) );
-   data.buffer_size      = cl::Buffer( data.context, CL_MEM_READ_ONLY, data.population_size * sizeof( int ) );
+// -----------------------------------------------------------------------------
+/* Sets the arguments of an evaluation kernel (kernel1 or one of its variants)
+   that don't change from one evaluation to another; the programs and the
+   number of individuals are given by acc_interpret (see adjust_ranges). */
+void set_evaluation_args( cl::Kernel& kernel1, int prediction_mode )
+{
+   kernel1.setArg( 0, data.buffer_program );
+   kernel1.setArg( 1, data.buffer_offset );
+   kernel1.setArg( 2, data.buffer_size );
+   kernel1.setArg( 3, data.buffer_inputs );
+   kernel1.setArg( 4, data.buffer_vector );
+   kernel1.setArg( 5, data.nlin );
+   kernel1.setArg( 6, data.ncol );
+   kernel1.setArg( 7, prediction_mode );
+   if( data.strategy == "PP" ) 
+   {
+      kernel1.setArg( 8, data.population_size );
+   }
+   else 
+   {
+      kernel1.setArg( 8, sizeof( float ) * data.local_size1, NULL ); // FIXME: Por que é size(float)?
+   }
+   if( fusing() ) // The penalization (alpha) is given by acc_interpret
+   {
+      kernel1.setArg( 9, data.buffer_best );
+      kernel1.setArg( 10, 0.0f );
+   }
+}
 
+// -----------------------------------------------------------------------------
+/* Creates the buffers whose sizes depend on the strategy (the errors computed
+   by kernel1 and the partial results of kernel2) and sets all the arguments
+   of the kernels (see setup_kernels). */
+void create_result_buffers( int ppp_mode, int prediction_mode )
+{
    if( ppp_mode && prediction_mode ) // Buffer (memory on the device) of prediction (one por example)
    { 
       data.buffer_vector = cl::Buffer( data.context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, data.nlin * sizeof( float ) );
@@ -489,12 +573,18 @@ void create_buffers( float** input, int ncol, int ppp_mode, int prediction_mode
       {
          data.buffer_vector = cl::Buffer( data.context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, (data.global_size1/data.local_size1) * data.population_size * sizeof( float ) );
 
-         data.buffer_error = cl::Buffer( data.context, CL_MEM_READ_ONLY, data.population_size * sizeof( float ) );
+         // The fitnesses: written by reduce_dp and read by best_individuals (and the host)
+         data.buffer_error = cl::Buffer( data.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, data.population_size * sizeof( float ) );
          if( !ppp_mode) {data.kernel2.setArg( 0, data.buffer_error );}
+
+         data.kernel_reduce.setArg( 0, data.buffer_vector );
+         data.kernel_reduce.setArg( 2, data.buffer_error );
+         data.kernel_reduce.setArg( 3, data.nlin );
+         data.kernel_reduce.setArg( 4, (int) (data.global_size1/data.local_size1) );
       }
       else
       {
-         if( data.strategy == "PDP" || data.strategy == "PP" ) // (one por program)
+         if( data.strategy == "PDP" || data.strategy == "PP" || data.strategy == "HYBRID" ) // (one por program)
          {
             // The evaluate's kernels WRITE in the vector; while the best_individual's kernel READ the vector
             data.buffer_vector = cl::Buffer( data.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, data.population_size * sizeof( float ) );
@@ -504,157 +594,1274 @@ void create_buffers( float** input, int ncol, int ppp_mode, int prediction_mode
       }
    }
 
-   data.kernel1.setArg( 0, data.buffer_phenotype );
-   data.kernel1.setArg( 1, data.buffer_ephemeral );
-   data.kernel1.setArg( 2, data.buffer_size );
-   data.kernel1.setArg( 3, data.buffer_inputs );
-   data.kernel1.setArg( 4, data.buffer_vector );
-   data.kernel1.setArg( 5, data.nlin );
-   data.kernel1.setArg( 6, ncol );
-   data.kernel1.setArg( 7, prediction_mode );
-   if( data.strategy == "PP" ) 
-   {
-      data.kernel1.setArg( 8, data.population_size );
-   }
-   else 
+   if( fusing() ) data.buffer_best = cl::Buffer( data.context, CL_MEM_READ_WRITE, sizeof( cl_ulong ) );
+
+   // The same arguments for every variant of kernel1 built so far (see select_variant)
+   for( unsigned v = 0; v < data.variant_kernel.size(); ++v )
+      if( data.variant_kernel[v]() != NULL ) set_evaluation_args( data.variant_kernel[v], prediction_mode );
+   if( data.strategy == "HYBRID" ) // The programs and the number of individuals are given by acc_interpret
    {
-      data.kernel1.setArg( 8, sizeof( float ) * data.local_size1, NULL ); // FIXME: Por que é size(float)?
+      data.kernel_pp.setArg( 3, data.buffer_inputs );
+      data.kernel_pp.setArg( 4, data.buffer_vector );
+      data.kernel_pp.setArg( 5, data.nlin );
+      data.kernel_pp.setArg( 6, data.ncol );
+      data.kernel_pp.setArg( 7, prediction_mode );
    }
 
 
    if ( !ppp_mode )
    {
-      const unsigned num_work_groups2 = data.global_size2 / data.local_size2;
+      // Up to local_size2 candidates per work-group (see pick_best)
+      data.buffer_candidates = cl::Buffer( data.context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, data.global_size2 * sizeof( cl_ulong ) );
+
+      data.kernel2.setArg( 1, data.buffer_candidates );
+      data.kernel2.setArg( 2, sizeof( cl_ulong ) * data.local_size2, NULL );
+      data.kernel2.setArg( 3, data.population_size );
+      data.kernel2.setArg( 4, 1 );
+      data.kernel2.setArg( 5, sizeof( cl_mem ), NULL ); // Fitnesses, unless given by acc_interpret (PP and PDP)
+      data.kernel2.setArg( 6, 0.0f );
+   }
+}
 
-      data.buffer_pb = cl::Buffer( data.context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, num_work_groups2 * sizeof( float ) );
-      data.buffer_pi = cl::Buffer( data.context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, num_work_groups2 * sizeof( int ) );
 
-      data.kernel2.setArg( 1, data.buffer_pb );
-      data.kernel2.setArg( 2, data.buffer_pi );
-      data.kernel2.setArg( 3, sizeof( float ) * data.local_size2, NULL ); // FIXME: Por que é size(float)?
-      data.kernel2.setArg( 4, sizeof( int ) * data.local_size2, NULL );
-      data.kernel2.setArg( 5, data.population_size );
-   }
+// -----------------------------------------------------------------------------
+/* Picks as kernel1 the variant with the smallest stack that fits programs of
+   the given maximum depth (0: unknown, hence the full one). A variant is built
+   (or loaded from the binary cache) the first time it is picked. */
+void select_variant( int depth )
+{
+   unsigned v = depth > 0 ? 0 : data.variant_kernel.size() - 1;
+   while( v + 1 < data.variant_kernel.size() && data.variant_depth[v] < (unsigned) depth ) ++v;
 
-#ifdef PROFILING
+   if( data.variant_kernel[v]() == NULL )
    {
-      std::vector<cl::Event> e(1, events[1]); 
-      cl::Event::waitForEvents(e);
+      if( data.variant_program[v]() == NULL )
+      {
+         if( data.verbose ) std::cout << "Building the kernels with a stack of " << data.variant_depth[v] << std::endl;
+         data.variant_program[v] = build_program( data.context, data.device, "#define MAX_STACK_SIZE " + util::ToString( data.variant_depth[v] ) + "\n" + data.variant_source, data.build_options );
+      }
+      const std::string name = data.variant_kernel.back().getInfo<CL_KERNEL_FUNCTION_NAME>();
+      data.variant_kernel[v] = cl::Kernel( data.variant_program[v], name.c_str() );
+      set_evaluation_args( data.variant_kernel[v], 0 ); // There are no variants in ppp mode
    }
-
-   cl_ulong start, end;
-   events[0].getProfilingInfo( CL_PROFILING_COMMAND_START, &start );
-   events[1].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
-   data.time_communication_dataset = (end - start)/1.0E9;
-#endif
-
+   data.kernel1 = data.variant_kernel[v];
 }
 
 
-/** ****************************************************************** **/
-/** ************************* MAIN FUNCTION ************************** **/
-/** ****************************************************************** **/
-
 // -----------------------------------------------------------------------------
-int acc_interpret_init( int argc, char** argv, const unsigned size, const unsigned max_arity, const unsigned population_size, float** input, int nlin, int ncol, int ppp_mode, int prediction_mode )
-{
-   CmdLine::Parser Opts( argc, argv );
 
-   // Get the executable directory so we can find the kernels later, regardless
-   // of the current directory (user directory).
-   data.executable_directory = getAbsoluteDirectory(argv[0]);
-
-   Opts.Bool.Add( "-transpose", "--transpose" );
-   Opts.Bool.Add( "-v", "--verbose" );
-   Opts.Int.Add( "-cl-p", "--cl-platform-id", -1, 0 );
-   Opts.Int.Add( "-cl-d", "--cl-device-id", -1, 0 );
-   Opts.Int.Add( "-cl-mls", "--cl-max-local-size", -1 );
-   Opts.String.Add( "-type" );
-   Opts.String.Add( "-strategy", "", "PDP", "pdp", "DP", "dp", "PP", "pp", "PDP", NULL );
-   Opts.Process();
-   data.verbose = Opts.Bool.Get("-v");
-   data.transpose = Opts.Bool.Get("-transpose");
+void create_buffers( const util::Dataset& input, int ppp_mode, int prediction_mode )
+{
+#ifdef PROFILING
+   std::vector<cl::Event> events(2); 
+#endif
 
-   data.strategy = Opts.String.Get("-strategy");
-   if (data.strategy == "pdp")
-      data.strategy = "PDP";
-   else if (data.strategy == "dp")
-      data.strategy = "DP";
-   else if (data.strategy == "pp")
-      data.strategy = "PP";
+   const util::Dataset::Layout layout = data.transpose ? util::Dataset::COLUMN_MAJOR : util::Dataset::ROW_MAJOR;
+   if( input.layout == layout )
+   {
+      /* The dataset is already in the layout wanted by the kernels, so the
+         device can use it in place (zero-copy on CPUs and integrated GPUs,
+         where it only has to be mapped; discrete GPUs cache a copy of it). */
+      data.buffer_inputs = cl::Buffer( data.context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, input.Bytes(), input.values );
+#ifdef PROFILING
+      data.time_communication_dataset = 0.0;
+#endif
+   }
+   else
+   {
+      // Buffer (memory on the device) of training points (input, model and obs)
+      const size_t bytes = (size_t) data.nlin * input.ncol * sizeof( float );
+      data.buffer_inputs = cl::Buffer( data.context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, bytes );
 
-   data.max_size = size;
-   data.max_arity = max_arity;
-   data.nlin = nlin;
-   data.population_size = population_size;
+      float* inputs = (float*) data.queue.enqueueMapBuffer( data.buffer_inputs, CL_TRUE, CL_MAP_WRITE, 0, bytes, NULL
 #ifdef PROFILING
-   data.time_total_kernel1  = 0.0;
-   data.time_total_kernel2  = 0.0;
-   data.time_total_communication_send1    = 0.0;
-   data.time_total_communication_send2    = 0.0;
-   data.time_total_communication_receive1 = 0.0;
-   data.time_total_communication_receive2 = 0.0;
-   data.time_total_communication1         = 0.0;
+      , &events[0]
 #endif
+      );
 
-   cl_device_type type = CL_INVALID_DEVICE_TYPE;
-   if( Opts.String.Found("-type") )
-   {
-      if( Opts.String.Get("-type") == "CPU" || Opts.String.Get("-type") == "cpu" )
+
+      if (data.transpose)
       {
-         type = CL_DEVICE_TYPE_CPU;
-      }
-      else 
+         // Transposed version for coalesced access on the GPU
+         /*
+         TRANSPOSITION (for coalesced access on the GPU)
+
+                                    Transformed and linearized data points
+                                    +----------++----------+   +----------+
+                                    | 1 2     q|| 1 2     q|   | 1 2     q|
+              +-------------------> |X X ... X ||X X ... X |...|X X ... X |
+              |                     | 1 1     1|| 2 2     2|   | p p     p|
+              |                     +----------++----------+   +----------+
+              |                                ^             ^
+              |    ____________________________|             |
+              |   |       ___________________________________|
+              |   |      |
+            +--++--+   +--+
+            | 1|| 1|   | 1|
+            |X ||X |...|X |
+            | 1|| 2|   | p|
+            |  ||  |   |  |
+            | 2|| 2|   | 2|
+            |X ||X |...|X |
+            | 1|| 2|   | p|
+            |. ||. |   |. |
+            |. ||. |   |. |
+            |. ||. |   |. |
+            | q|| q|   | q|
+            |X ||X |...|X |
+            | 1|| 2|   | p|
+            +--++--+   +--+
+         Original data points
+
+         */
+         for( int j = 0; j < input.ncol; j++ )
+         {
+            for( int i = 0; i < data.nlin; i++ )
+            {
+               inputs[j * data.input_stride + i] = input( i, j );
+            }
+         }
+      }
+      else
+      {
+         for( int i = 0; i < data.nlin; i++ )
+         {
+            for( int j = 0; j < input.ncol; j++ )
+            {
+               inputs[i * input.ncol + j] = input( i, j );
+            }
+         }
+      }
+
+      //if( data.strategy == "PP" ) 
+      //{
+      //   for( int i = 0; i < data.nlin; i++ )
+      //   {
+      //      for( int j = 0; j < ncol; j++ )
+      //      {
+      //         inputs[i * ncol + j] = input[i][j];
+      //      }
+      //   }
+      //}
+      //else
+      //{
+      //   if( data.strategy == "DP" || data.strategy == "PDP" ) 
+      //   {
+      //      for( int i = 0; i < data.nlin; i++ )
+      //      {
+      //         for( int j = 0; j < ncol; j++ )
+      //         {
+      //            inputs[j * data.nlin + i] = input[i][j];
+      //         }
+      //      }
+      //   }
+      //   else
+      //   {
+      //      fprintf(stderr, "Valid strategy: PP, DP and PDP.\n");
+      //   }
+      //}
+
+      // Unmapping
+      data.queue.enqueueUnmapMemObject( data.buffer_inputs, inputs, NULL
+#ifdef PROFILING
+      , &events[1]
+#endif
+      );
+
+#ifdef PROFILING
+      {
+         std::vector<cl::Event> e(1, events[1]); 
+         cl::Event::waitForEvents(e);
+      }
+
+      cl_ulong start, end;
+      events[0].getProfilingInfo( CL_PROFILING_COMMAND_START, &start );
+      events[1].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
+      data.time_communication_dataset = (end - start)/1.0E9;
+#endif
+   }
+
+   //inputs = (float*) data.queue.enqueueMapBuffer( data.buffer_inputs, CL_TRUE, CL_MAP_READ, 0, data.nlin * ncol * sizeof( float ) );
+   //for( int i = 0; i < data.nlin * ncol; i++ )
+   //{
+   //   if( i % data.nlin == 0 ) fprintf(stdout,"\n");
+   //   fprintf(stdout,"%f ", inputs[i]);
+   //}
+   //data.queue.enqueueUnmapMemObject( data.buffer_inputs, inputs ); 
+
+   /* Buffer (memory on the device) of the programs (instructions followed by
+      their constant pools), which are packed back to back (see 'offset'); it
+      starts with room for programs of a few symbols and grows on demand (see
+      acc_interpret). */
+   data.program_capacity = data.population_size * std::min( 64, data.max_size );
+   data.buffer_program   = cl::Buffer( data.context, CL_MEM_READ_WRITE, data.program_capacity * sizeof( Instruction ) );
+   data.buffer_offset    = cl::Buffer( data.context, CL_MEM_READ_WRITE, data.population_size * sizeof( int ) );
+   data.buffer_size      = cl::Buffer( data.context, CL_MEM_READ_WRITE, data.population_size * sizeof( int ) );
+
+   data.ncol = input.ncol;
+
+   create_result_buffers( ppp_mode, prediction_mode );
+}
+
+// -----------------------------------------------------------------------------
+/* Sets up the devices among which the population will be split: the first one
+   of 'list' (platform, device) is the one already set up by opencl_init, the
+   others, possibly from other platforms, get their own context, build of the
+   kernels and copy of the dataset (in the layout of the first one's). */
+int devices_init( const std::vector< std::pair<int,int> >& list, int maxlocalsize )
+{
+   vector<cl::Platform> platforms;
+   cl::Platform::get( &platforms );
+
+   const size_t bytes = data.buffer_inputs.getInfo<CL_MEM_SIZE>();
+   std::vector<float> inputs( bytes / sizeof( float ) );
+   data.queue.enqueueReadBuffer( data.buffer_inputs, CL_TRUE, 0, bytes, &inputs[0] );
+
+   /* Every device runs the plain kernel of the strategy, with the full stack:
+      neither the fused kernels nor the variants with smaller stacks (see
+      select_variant) are used */
+   const char* name = data.strategy == "PP" ? "evaluate_pp" : data.strategy == "DP" ? "evaluate_dp" : "evaluate_pdp";
+   if( data.fused ) fprintf(stderr, "-fused is ignored with several devices.\n");
+   if( data.verbose && data.variant_depth.size() > 1 ) std::cout << "The kernels with smaller stacks are not used with several devices" << std::endl;
+
+   data.devices.resize( list.size() );
+   for( unsigned d = 0; d < list.size(); ++d )
+   {
+      t_device& dev = data.devices[d];
+      if( d == 0 )
+      {
+         dev.device = data.device; dev.context = data.context; dev.program = data.program;
+         dev.inputs = data.buffer_inputs;
+      }
+      else
+      {
+         vector<cl::Device> devices;
+         if( list[d].first >= (int) platforms.size() )
+         {
+            fprintf(stderr, "Valid platform range: [0, %d].\n", (int) (platforms.size()-1));
+            return 1;
+         }
+         platforms[list[d].first].getDevices( CL_DEVICE_TYPE_ALL, &devices );
+         if( list[d].second >= (int) devices.size() ) 
+         {
+            fprintf(stderr, "Valid device range: [0, %d].\n", (int) (devices.size()-1));
+            return 1;
+         }
+
+         dev.device = devices[list[d].second];
+         dev.context = cl::Context( vector<cl::Device>( 1, dev.device ) );
+         dev.program = build_program( dev.context, dev.device, data.kernel_source, data.build_options );
+         dev.inputs = cl::Buffer( dev.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &inputs[0] );
+      }
+
+      dev.queue = cl::CommandQueue( dev.context, dev.device, CL_QUEUE_PROFILING_ENABLE ); // See interpret_devices
+      dev.kernel = cl::Kernel( dev.program, name );
+      dev.local_size = evaluation_local_size( dev.device, max_evaluation_local_size( dev.device, maxlocalsize ) );
+      dev.global_size = (unsigned) ( ceil( data.nlin/(float) dev.local_size ) * dev.local_size ); // Only DP's is fixed
+      dev.num_partials = data.strategy == "DP" ? dev.global_size / dev.local_size : 0;
+
+      dev.capacity = 0;
+      dev.offset = cl::Buffer( dev.context, CL_MEM_READ_ONLY, data.population_size * sizeof( int ) );
+      dev.size   = cl::Buffer( dev.context, CL_MEM_READ_ONLY, data.population_size * sizeof( int ) );
+      dev.vector = cl::Buffer( dev.context, CL_MEM_WRITE_ONLY, data.population_size * std::max( dev.num_partials, 1 ) * sizeof( float ) );
+      dev.rate = 0.0; // Unknown yet
+
+      dev.kernel.setArg( 1, dev.offset );
+      dev.kernel.setArg( 2, dev.size );
+      dev.kernel.setArg( 3, dev.inputs );
+      dev.kernel.setArg( 4, dev.vector );
+      dev.kernel.setArg( 5, data.nlin );
+      dev.kernel.setArg( 6, data.ncol );
+      dev.kernel.setArg( 7, 0 );
+      if( data.strategy != "PP" ) dev.kernel.setArg( 8, sizeof( float ) * dev.local_size, NULL );
+
+      if( data.verbose ) std::cout << "Device " << d << ": " << dev.device.getInfo<CL_DEVICE_NAME>() << ", Local size: " << dev.local_size << std::endl;
+   }
+
+   return 0;
+}
+
+// -----------------------------------------------------------------------------
+/* Makes sure that the buffer of programs holds at least 'total_size' words;
+   it is enlarged (doubled) whenever it is not big enough. */
+void reserve_programs( unsigned total_size )
+{
+   if( total_size > data.program_capacity )
+   {
+      data.program_capacity = std::max( total_size, 2 * data.program_capacity );
+      data.buffer_program = cl::Buffer( data.context, CL_MEM_READ_WRITE, data.program_capacity * sizeof( Instruction ) );
+      data.kernel1.setArg( 0, data.buffer_program );
+      if( data.number_of_words ) { data.kernel_decode.setArg( 11, data.buffer_program ); }
+   }
+}
+
+
+// -----------------------------------------------------------------------------
+/* The number of individuals (nInd) may be smaller than the population size
+   (e.g. when neutral offspring are not evaluated), so the NDRanges that
+   depend on it are adjusted on every evaluation. */
+void adjust_ranges( int nInd, int ppp_mode, unsigned* global_size1, unsigned* global_size2 )
+{
+   *global_size1 = data.global_size1; *global_size2 = data.global_size2;
+   if( data.strategy == "DP" ) 
+   {
+      data.kernel1.setArg( 9, nInd );
+   }
+   else if( data.strategy == "PP" )
+   {
+      *global_size1 = (unsigned) ( ceil( nInd/(float) data.local_size1 ) * data.local_size1 );
+      data.kernel1.setArg( 8, nInd );
+   }
+   else // PDP: one individual per work-group
+   {
+      *global_size1 = nInd * data.local_size1;
+   }
+   if( !ppp_mode )
+   {
+      *global_size2 = (unsigned) ( ceil( nInd/(float) data.local_size2 ) * data.local_size2 );
+      data.kernel2.setArg( 3, nInd );
+   }
+}
+
+
+// -----------------------------------------------------------------------------
+/* The number of best individuals wanted, '*best_size', is given to kernel2
+   (clamped to 'nInd'), which then hands at most that many candidates per
+   work-group to pick_best. */
+void request_best( int nInd, int* best_size )
+{
+   if( *best_size > nInd ) { *best_size = nInd; }
+   data.kernel2.setArg( 4, (int) std::min( (unsigned) *best_size, data.local_size2 ) );
+}
+
+/* Index of the individual of a key given by the device (see fitness_key) */
+int key_index( cl_ulong key )
+{
+   return (int) (~key & 0xFFFFFFFF);
+}
+
+/* Picks the '*best_size' best individuals out of the candidates given by
+   kernel2 (a single small transfer): their indices go into 'index' */
+void pick_best( unsigned global_size2, int* index, const int* best_size )
+{
+   const unsigned k = std::min( (unsigned) *best_size, data.local_size2 );
+   std::vector<cl_ulong> keys( (global_size2 / data.local_size2) * k );
+   if( keys.empty() ) return;
+
+   data.queue.enqueueReadBuffer( data.buffer_candidates, CL_TRUE, 0, keys.size() * sizeof( cl_ulong ), &keys[0] );
+
+   // The keys are ordered by fitness (then index): a partial selection suffices
+   if( (size_t) *best_size < keys.size() ) std::nth_element( keys.begin(), keys.begin() + *best_size, keys.end() );
+   std::sort( keys.begin(), keys.begin() + *best_size );
+   for( int i = 0; i < *best_size; ++i ) index[i] = key_index( keys[i] );
+}
+
+// -----------------------------------------------------------------------------
+/* Turns the errors computed by kernel1 into the fitnesses ('vector') of the
+   'nInd' individuals, adding the complexity penalization. With DP there are
+   'num_partials' partial errors (one per work-group) per individual:
+
+      |  0 |  0 |     |  0    ||   1 |  1 |     |  1   |     |  ind-1 |  ind-1 |     |  ind-1 |
+      | E  | E  | ... | E     ||  E  | E  | ... | E    | ... | E      | E      | ... | E      |        
+      |  0 |  1 |     |  n-1  ||   0 |  1 |     |  n-1 |     |  0     |  1     |     |  n-1   |    
+
+   where 'ind-1' is the index of the last individual, and 'n-1' is the index of the
+   last 'partial error', that is, 'n-1' is the index of the last work-group (gr_id);
+   otherwise (num_partials == 0) there is already one error per individual. */
+void reduce_errors( const float* errors, int num_partials, int nInd, const int* size, float alpha, float* vector )
+{
+   if( num_partials == 0 )
+   {
+      for( int i = 0; i < nInd; i++ ) { vector[i] = errors[i] + alpha * size[i]; }
+      return;
+   }
+
+   // Reduction on host!
+   for( int i = 0; i < nInd; i++)
+   {
+      float sum = 0.0f;
+      for( int gr_id = 0; gr_id < num_partials; gr_id++ ) 
+      {
+         float error = errors[i * num_partials + gr_id];
+
+         // Avoid further calculations if the current one has overflown the float
+         // (i.e., it is inf or NaN).
+         if( isinf(error) || isnan(error) ) { sum = std::numeric_limits<float>::max(); break; }
+
+#ifdef REDUCEMAX
+         sum = (error*data.nlin > sum) ? error*data.nlin : sum;
+#else
+         sum += error;
+#endif
+      }
+
+      if( isnan( sum ) || isinf( sum ) )
+         vector[i] = std::numeric_limits<float>::max();
+      else
+         vector[i] = sum/data.nlin + alpha * size[i];
+   }
+}
+
+
+// -----------------------------------------------------------------------------
+/* Adapts the threshold of the HYBRID strategy (programs longer than it go to
+   the PDP kernel, the others to the PP one) from the time taken by the last
+   evaluation, from the start of the first kernel to the end of the last one,
+   per instruction evaluated ('cost'). It is a hill climbing: the threshold
+   keeps moving by a fixed factor, in the direction that lowers the cost, and
+   turns back as soon as the cost gets worse; it is also turned back when it
+   has gone past all the programs (all of them in a single kernel). */
+void adapt_threshold( double cost, int nLong, int nInd )
+{
+   if( cost > data.hybrid_cost ) data.hybrid_direction = -data.hybrid_direction;
+   if( nLong == 0 ) data.hybrid_direction = -1; else if( nLong == nInd ) data.hybrid_direction = 1;
+   data.hybrid_cost = cost;
+
+   if( data.hybrid_direction > 0 )
+      data.hybrid_threshold = std::min( (int) ceil( data.hybrid_threshold * 1.25 ), data.max_size );
+   else
+      data.hybrid_threshold = std::max( (int) floor( data.hybrid_threshold / 1.25 ), 1 );
+}
+
+// -----------------------------------------------------------------------------
+/* The autotuner's decisions are kept in a text file, one per line:
+
+      <key> TAB <strategy> TAB <maximum local size>
+
+   where the key identifies the device (name and driver version), the shape of
+   the dataset and of the population, and the problem (label); the last line
+   with a given key prevails. */
+std::string tuning_key( const util::Dataset& input )
+{
+   std::string key = data.device.getInfo<CL_DEVICE_NAME>() + "|" + data.device.getInfo<CL_DRIVER_VERSION>() + "|" +
+      util::ToString( input.nlin ) + "x" + util::ToString( input.ncol ) + "|" + util::ToString( data.population_size ) + "|" +
+      util::ToString( data.max_size ) + "|" + xstr(LABEL);
+
+   // The strings given by OpenCL may carry their terminating nulls
+   std::string clean;
+   for( size_t i = 0; i < key.size(); ++i ) if( key[i] != '\0' ) clean += key[i] == '\t' || key[i] == '\n' ? ' ' : key[i];
+   return clean;
+}
+
+bool load_tuning( std::string& strategy, int& max_local_size )
+{
+   ifstream file( data.tuning_file.c_str() );
+   bool found = false;
+
+   std::string line;
+   while( std::getline( file, line ) )
+   {
+      const size_t tab1 = line.find( '\t' ), tab2 = line.rfind( '\t' );
+      if( tab1 == std::string::npos || tab2 == tab1 || line.compare( 0, tab1, data.tuning_key ) != 0 || tab1 != data.tuning_key.size() ) continue;
+
+      const std::string s = line.substr( tab1 + 1, tab2 - tab1 - 1 );
+      if( s != "PP" && s != "DP" && s != "PDP" ) continue;
+
+      strategy = s; max_local_size = atoi( line.c_str() + tab2 + 1 ); found = true;
+   }
+
+   return found;
+}
+
+void save_tuning( const std::string& strategy, int max_local_size )
+{
+   ofstream file( data.tuning_file.c_str(), ios::app );
+   file << data.tuning_key << '\t' << strategy << '\t' << max_local_size << '\n';
+   if( !file ) fprintf(stderr, "Could not save the tuning into '%s'.\n", data.tuning_file.c_str());
+}
+
+// -----------------------------------------------------------------------------
+/* Times the evaluation of the 'nInd' programs already on the device with the
+   current strategy and local size just as acc_interpret does it: kernel1,
+   the reduction of the errors (on the device, by reduce_dp, for DP) and the
+   transfer of what the host needs, i.e., what depends on them. The best of a
+   few runs, after a warm-up one, is taken. */
+double trial( int nInd, const int* size )
+{
+   unsigned global_size1, global_size2;
+   adjust_ranges( nInd, 1, &global_size1, &global_size2 );
+
+   const bool dp = data.strategy == "DP";
+   if( dp )
+   {
+      data.kernel_reduce.setArg( 1, data.buffer_size );
+      data.kernel_reduce.setArg( 5, 0.0f );
+      data.kernel_reduce.setArg( 6, nInd );
+   }
+   std::vector<float> errors( nInd ), vector( nInd );
+
+   double best = std::numeric_limits<double>::max();
+   for( int run = 0; run < 4; ++run )
+   {
+      util::Timer t;
+      data.queue.enqueueNDRangeKernel( data.kernel1, cl::NDRange(), cl::NDRange( global_size1 ), cl::NDRange( data.local_size1 ) );
+      if( dp )
+      {
+         data.queue.enqueueNDRangeKernel( data.kernel_reduce, cl::NDRange(), cl::NDRange( nInd ), cl::NullRange );
+         data.queue.enqueueReadBuffer( data.buffer_error, CL_TRUE, 0, nInd * sizeof( float ), &vector[0] );
+      }
+      else
+      {
+         data.queue.enqueueReadBuffer( data.buffer_vector, CL_TRUE, 0, nInd * sizeof( float ), &errors[0] );
+         reduce_errors( &errors[0], 0, nInd, size, 0.0, &vector[0] );
+      }
+      if( run > 0 ) best = std::min( best, t.elapsed() );
+   }
+
+   return best;
+}
+
+// -----------------------------------------------------------------------------
+/* Evaluates the 'nInd' programs on all the devices (see devices_init), each
+   one taking a contiguous slice of the population; the fitnesses are merged
+   into 'vector' and the best individuals picked on the host.
+
+   The slices are balanced by the amount of work, the number of instructions
+   (plus one per program), in proportion to the throughput of each device
+   measured in the previous generations (from its first transfer to the end
+   of the reading of its errors); a device not measured yet is assumed to be
+   as fast as the average. Every device takes at least one program (if there
+   are enough of them), so that its throughput is measured again in every
+   generation, even after a slow one. */
+void interpret_devices( const Instruction* program, const int* offset, const int* size, float* vector, int nInd, void (*send)(Population*), int (*receive)(Population*), Population* migrants, int* nImmigrants, int* index, int* best_size, float alpha )
+{
+   const int nDevices = data.devices.size();
+
+   double known = 0.0; int nKnown = 0;
+   for( int d = 0; d < nDevices; ++d ) if( data.devices[d].rate > 0.0 ) { known += data.devices[d].rate; ++nKnown; }
+   const double average = nKnown ? known / nKnown : 1.0;
+
+   double total_rate = 0.0, work = 0.0;
+   for( int d = 0; d < nDevices; ++d ) total_rate += data.devices[d].rate > 0.0 ? data.devices[d].rate : average;
+   for( int i = 0; i < nInd; ++i ) work += size[i] + 1;
+
+   double target = 0.0, done = 0.0; int begin = 0;
+   for( int d = 0; d < nDevices; ++d )
+   {
+      t_device& dev = data.devices[d];
+      target += work * (dev.rate > 0.0 ? dev.rate : average) / total_rate;
+
+      // One program is left for each of the next devices
+      const int last = nInd - (nDevices - 1 - d);
+      int end = begin; const double before = done;
+      while( end < last && (d == nDevices - 1 || end == begin || done + size[end] + 1 <= target) ) { done += size[end] + 1; ++end; }
+      dev.begin = begin; dev.end = end; dev.work = done - before;
+      begin = end;
+
+      const int n = dev.end - dev.begin;
+      if( n == 0 ) continue;
+
+      const int base = offset[dev.begin];
+      const unsigned total_size = std::max( offset[dev.end] - base, 1 ); // A zero-sized transfer would be an error
+      if( total_size > dev.capacity )
+      {
+         dev.capacity = std::max( total_size, 2 * dev.capacity );
+         dev.program_buffer = cl::Buffer( dev.context, CL_MEM_READ_ONLY, dev.capacity * sizeof( Instruction ) );
+         dev.kernel.setArg( 0, dev.program_buffer );
+      }
+      dev.rebased.resize( n );
+      for( int k = 0; k < n; ++k ) dev.rebased[k] = offset[dev.begin + k] - base;
+      dev.errors.resize( n * std::max( dev.num_partials, 1 ) );
+
+      unsigned global_size;
+      if( data.strategy == "PP" )
+      {
+         global_size = (unsigned) ( ceil( n/(float) dev.local_size ) * dev.local_size );
+         dev.kernel.setArg( 8, n );
+      }
+      else if( data.strategy == "DP" )
+      {
+         global_size = dev.global_size;
+         dev.kernel.setArg( 9, n );
+      }
+      else // PDP: one individual per work-group
+      {
+         global_size = n * dev.local_size;
+      }
+
+      // Nothing blocks here, so that all the devices work at the same time
+      dev.queue.enqueueWriteBuffer( dev.program_buffer, CL_FALSE, 0, total_size * sizeof( Instruction ), program + base, NULL, &dev.sent );
+      dev.queue.enqueueWriteBuffer( dev.offset, CL_FALSE, 0, n * sizeof( int ), &dev.rebased[0] );
+      dev.queue.enqueueWriteBuffer( dev.size, CL_FALSE, 0, n * sizeof( int ), size + dev.begin );
+      try {
+         dev.queue.enqueueNDRangeKernel( dev.kernel, cl::NDRange(), cl::NDRange( global_size ), cl::NDRange( dev.local_size ) );
+      }
+      catch( cl::Error& e )
+      {
+         cerr << "\nERROR(kernel1, device " << d << "): " << e.what() << " ( " << e.err() << " )\n";
+         throw;
+      }
+      dev.queue.enqueueReadBuffer( dev.vector, CL_FALSE, 0, dev.errors.size() * sizeof( float ), &dev.errors[0], NULL, &dev.done );
+      dev.queue.flush();
+   }
+
+   send( migrants );
+   *nImmigrants = receive( migrants );
+
+   for( int d = 0; d < nDevices; ++d )
+   {
+      t_device& dev = data.devices[d];
+      const int n = dev.end - dev.begin;
+      if( n == 0 ) continue;
+
+      dev.done.wait();
+      reduce_errors( &dev.errors[0], dev.num_partials, n, size + dev.begin, alpha, vector + dev.begin );
+
+      // The throughput is smoothed over the generations
+      cl_ulong start, end;
+      dev.sent.getProfilingInfo( CL_PROFILING_COMMAND_START, &start );
+      dev.done.getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
+      const double rate = dev.work / std::max( (end - start)/1.0E9, 1.0E-9 );
+      dev.rate = dev.rate > 0.0 ? 0.5 * (dev.rate + rate) : rate;
+   }
+
+   if( *best_size > nInd ) { *best_size = nInd; }
+   util::PickNBest( *best_size, index, nInd, vector );
+}
+
+
+// -----------------------------------------------------------------------------
+/* Reads a platform or device index of -cl-d, which must be a whole number */
+bool parse_index( const std::string& s, int& n )
+{
+   char* end; n = strtol( s.c_str(), &end, 10 );
+   return !s.empty() && (s[0] == '-' || (s[0] >= '0' && s[0] <= '9')) && *end == '\0';
+}
+
+
+/** ****************************************************************** **/
+/** ************************* MAIN FUNCTION ************************** **/
+/** ****************************************************************** **/
+
+// -----------------------------------------------------------------------------
+int acc_interpret_init( int argc, char** argv, const unsigned size, const unsigned max_arity, const unsigned population_size, const util::Dataset& input, int ppp_mode, int prediction_mode )
+{
+   CmdLine::Parser Opts( argc, argv );
+
+   // Get the executable directory so we can find the kernels later, regardless
+   // of the current directory (user directory).
+   data.executable_directory = getAbsoluteDirectory(argv[0]);
+
+   Opts.Bool.Add( "-transpose", "--transpose" );
+   Opts.Bool.Add( "-v", "--verbose" );
+   Opts.Int.Add( "-cl-p", "--cl-platform-id", -1, 0 );
+   Opts.String.Add( "-cl-d", "--cl-device-id", "-1" );
+   Opts.Int.Add( "-cl-mls", "--cl-max-local-size", -1 );
+   Opts.String.Add( "-type" );
+   Opts.String.Add( "-strategy", "", "PDP", "pdp", "DP", "dp", "PP", "pp", "PDP", "HYBRID", "hybrid", NULL );
+   Opts.Bool.Add( "-autotune", "--autotune" );
+   Opts.String.Add( "-autotune-file", "--autotune-file" );
+   Opts.Bool.Add( "-fused", "--fused" );
+   Opts.String.Add( "-cl-cache", "--cl-binary-cache" );
+   Opts.Bool.Add( "-cl-no-cache", "--cl-no-binary-cache" );
+   Opts.Process();
+   data.verbose = Opts.Bool.Get("-v");
+   data.transpose = Opts.Bool.Get("-transpose");
+
+   data.strategy = Opts.String.Get("-strategy");
+   if (data.strategy == "pdp")
+      data.strategy = "PDP";
+   else if (data.strategy == "dp")
+      data.strategy = "DP";
+   else if (data.strategy == "pp")
+      data.strategy = "PP";
+   else if (data.strategy == "hybrid")
+      data.strategy = "HYBRID";
+
+   data.max_size = size;
+   data.max_arity = max_arity;
+   data.nlin = input.nlin;
+   data.population_size = population_size;
+
+   /* Distance between the columns of the transposed dataset: its (padded)
+      stride if used in place, or just the number of points if copied */
+   data.input_stride = data.transpose && input.layout == util::Dataset::COLUMN_MAJOR ? input.stride : input.nlin;
+#ifdef PROFILING
+   data.time_total_kernel1  = 0.0;
+   data.time_total_kernel2  = 0.0;
+   data.time_total_communication_send1    = 0.0;
+   data.time_total_communication_send2    = 0.0;
+   data.time_total_communication_receive1 = 0.0;
+   data.time_total_communication_receive2 = 0.0;
+   data.time_total_communication1         = 0.0;
+#endif
+
+   cl_device_type type = CL_INVALID_DEVICE_TYPE;
+   if( Opts.String.Found("-type") )
+   {
+      if( Opts.String.Get("-type") == "CPU" || Opts.String.Get("-type") == "cpu" )
+      {
+         type = CL_DEVICE_TYPE_CPU;
+      }
+      else 
+      {
+         if( Opts.String.Get("-type") == "GPU" || Opts.String.Get("-type") == "gpu" )
+         {
+            type = CL_DEVICE_TYPE_GPU;
+         }
+         else
+         {
+            fprintf(stderr, "Not a single compatible device found.\n");
+            return 1;
+         }
+      }
+   }
+
+   if( input.ncol <= 0 )
+   {
+      fprintf(stderr, "Missing number of columns of dataset.\n");
+      return 1;
+   }
+
+   /* The devices are given as a comma-separated list of either 'device' (of
+      the platform -cl-p) or 'platform:device'; the population is split among
+      them (see interpret_devices), the first one doing all the rest. */
+   {
+      std::string list = Opts.String.Get("-cl-d");
+      for( size_t pos = 0; pos <= list.size(); )
+      {
+         size_t next = list.find( ',', pos ); if( next == std::string::npos ) next = list.size();
+         const std::string entry = list.substr( pos, next - pos );
+         const size_t colon = entry.find( ':' );
+         // Only the first device may be chosen by opencl_init (platform -1)
+         int platform = data.device_list.empty() ? Opts.Int.Get("-cl-p") : std::max( Opts.Int.Get<int>("-cl-p"), 0 ), device;
+         bool valid;
+         if( colon == std::string::npos )
+            valid = parse_index( entry, device ) && (device >= 0 || data.device_list.empty());
+         else
+            valid = parse_index( entry.substr( 0, colon ), platform ) && parse_index( entry.substr( colon + 1 ), device ) && platform >= 0 && device >= 0;
+         if( !valid )
+         {
+            fprintf(stderr, "Invalid device '%s' in -cl-d: expected 'device' or 'platform:device' (comma-separated).\n", entry.c_str());
+            return 1;
+         }
+         data.device_list.push_back( std::make_pair( platform, device ) );
+         pos = next + 1;
+      }
+   }
+
+   if ( opencl_init( data.device_list[0].first, data.device_list[0].second, type ) )
+   {
+      fprintf(stderr,"Error in OpenCL initialization phase.\n");
+      return 1;
+   }
+
+   /* With -autotune, the strategy and the maximum local size are those found
+      for this device and problem by a previous sweep (see acc_autotune), if
+      any; otherwise the sweep is due, on the first population. */
+   int max_local_size = Opts.Int.Get("-cl-mls");
+   data.autotune = Opts.Bool.Get("-autotune") && !ppp_mode;
+   if( data.autotune )
+   {
+      data.tuning_file = Opts.String.Found("-autotune-file") ? Opts.String.Get("-autotune-file") : data.executable_directory + "ppi-tuning.txt";
+      data.tuning_key = tuning_key( input );
+      if( load_tuning( data.strategy, max_local_size ) )
+      {
+         data.autotune = false;
+         if( data.verbose ) std::cout << "\nAutotune: " << data.strategy << " with maximum local size " << max_local_size << " (from '" << data.tuning_file << "')" << std::endl;
+      }
+   }
+
+   /* With -fused, PP and PDP find the best individual while evaluating (see
+      evaluate_pp_best), which needs 64-bit atomics */
+   data.fused = Opts.Bool.Get("-fused") && !ppp_mode;
+   if( data.fused && data.device.getInfo<CL_DEVICE_EXTENSIONS>().find( "cl_khr_int64_base_atomics" ) == std::string::npos )
+   {
+      fprintf(stderr, "No 64-bit atomics on this device: -fused ignored.\n");
+      data.fused = false;
+   }
+
+   /* The binaries of the kernels are cached (see build_program) in the given
+      directory or, by default, in the one of the executable */
+   if( !Opts.Bool.Get("-cl-no-cache") )
+   {
+      data.binary_cache = Opts.String.Found("-cl-cache") ? Opts.String.Get("-cl-cache") : data.executable_directory;
+      if( !data.binary_cache.empty() && data.binary_cache[data.binary_cache.size() - 1] != '/' ) data.binary_cache += '/';
+   }
+
+   data.max_local_size = max_local_size; // Possibly the tuned one (see load_tuning)
+   if ( build_kernel( max_local_size, ppp_mode, prediction_mode ) )
+   {
+      fprintf(stderr,"Error in build the kernel.\n");
+      return 1;
+   }
+
+   create_buffers( input, ppp_mode, prediction_mode );
+
+//   try
+//   {
+//   }
+//   catch( cl::Error& e )
+//   {
+//      cerr << "ERROR: " << e.what() << " ( " << e.err() << " )\n";
+//   }
+
+   return 0;
+}
+
+// -----------------------------------------------------------------------------
+bool acc_autotuning()
+{
+   return data.autotune;
+}
+
+// -----------------------------------------------------------------------------
+int acc_autotune( const Instruction* program, const int* offset, const int* size, int nInd )
+{
+   if( !data.autotune || nInd == 0 ) return 0;
+   data.autotune = false;
+
+   const unsigned total_size = std::max( offset[nInd], 1 ); // A zero-sized transfer would be an error
+   reserve_programs( total_size );
+   data.queue.enqueueWriteBuffer( data.buffer_program, CL_TRUE, 0, total_size * sizeof( Instruction ), program );
+   data.queue.enqueueWriteBuffer( data.buffer_offset, CL_TRUE, 0, nInd * sizeof( int ), offset );
+   data.queue.enqueueWriteBuffer( data.buffer_size, CL_TRUE, 0, nInd * sizeof( int ), size );
+
+   /* The candidate maximum local sizes: the heuristic one of setup_kernels
+      (-1) and the powers of two up to what the device allows */
+   const unsigned limit = std::min( std::min( data.device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>(), data.device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>()[0] ), (size_t) data.device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / 4 );
+   std::vector<int> sizes( 1, -1 );
+   for( unsigned l = 16; l <= limit; l *= 2 ) sizes.push_back( l );
+
+   const char* strategies[] = { "PP", "DP", "PDP" };
+   std::string best_strategy = data.strategy; int best_size = -1;
+   double best_time = std::numeric_limits<double>::max();
+
+   const bool verbose = data.verbose; data.verbose = false;
+   for( int s = 0; s < 3; ++s )
+   {
+      data.strategy = strategies[s];
+
+      std::vector<unsigned> tried; // Different maximums may lead to the same local size
+      for( unsigned i = 0; i < sizes.size(); ++i )
+      {
+         try
+         {
+            setup_kernels( sizes[i], 0 );
+            if( std::find( tried.begin(), tried.end(), data.local_size1 ) != tried.end() ) continue;
+            tried.push_back( data.local_size1 );
+
+            create_result_buffers( 0, 0 );
+            const double time = trial( nInd, size );
+            if( verbose ) std::cout << "Autotune: " << data.strategy << ", local size " << data.local_size1 << ": " << time << "s" << std::endl;
+
+            if( time < best_time ) { best_time = time; best_strategy = data.strategy; best_size = sizes[i]; }
+         }
+         catch( cl::Error& e ) // e.g., not enough resources for this local size
+         {
+            if( verbose ) std::cout << "Autotune: " << data.strategy << ", maximum local size " << sizes[i] << ": " << e.what() << " ( " << e.err() << " )" << std::endl;
+         }
+      }
+   }
+   data.verbose = verbose;
+
+   data.strategy = best_strategy;
+   data.max_local_size = best_size; // Also for the other devices (see devices_init)
+   if( setup_kernels( best_size, 0 ) ) return 1;
+   create_result_buffers( 0, 0 );
+
+   save_tuning( best_strategy, best_size );
+   if( data.verbose ) std::cout << "Autotune: " << best_strategy << " with maximum local size " << best_size << " (saved into '" << data.tuning_file << "')" << std::endl;
+
+   return 0;
+}
+
+// -----------------------------------------------------------------------------
+int acc_decode_init( const int* grammar, int grammar_size, int initial_symbol, int number_of_words, int number_of_bits, int bits_per_gene, int bits_per_constant, const float* interval )
+{
+   if( data.number_of_words )
+   {
+      fprintf(stderr, "The device decoding was already initialized.\n");
+      return 1;
+   }
+
+   data.number_of_words = number_of_words;
+
+   /* The grammar is read from the constant memory (see the decode kernel),
+      which is usually small (e.g., 64 KiB); a larger grammar is read from the
+      global memory instead, by a decode kernel built for that. */
+   if( grammar_size * sizeof( int ) > data.device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>() )
+   {
+      if( data.verbose ) std::cout << "The grammar (" << grammar_size * sizeof( int ) << " bytes) does not fit into the constant memory: it is read from the global memory" << std::endl;
+      data.kernel_decode = cl::Kernel( build_program( data.context, data.device, data.kernel_source, data.build_options + " -DGRAMMAR_SPACE=__global" ), "decode" );
+   }
+
+   /* Each individual is decoded into its own slot of the buffer of programs:
+      room for the largest program (plus the last rule) and as many constants */
+   data.slot_size = 2 * (data.max_size + std::max( data.max_arity, 1 ));
+   reserve_programs( data.population_size * data.slot_size );
+
+   data.buffer_genomes = cl::Buffer( data.context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, data.population_size * number_of_words * sizeof( GENOME_TYPE ) );
+   data.buffer_grammar = cl::Buffer( data.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, grammar_size * sizeof( int ), (void*) grammar );
+   data.buffer_length  = cl::Buffer( data.context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, data.population_size * sizeof( int ) );
+
+   data.kernel_decode.setArg( 0, data.buffer_genomes );
+   data.kernel_decode.setArg( 1, number_of_words );
+   data.kernel_decode.setArg( 2, data.buffer_grammar );
+   data.kernel_decode.setArg( 3, initial_symbol );
+   data.kernel_decode.setArg( 4, number_of_bits );
+   data.kernel_decode.setArg( 5, bits_per_gene );
+   data.kernel_decode.setArg( 6, bits_per_constant );
+   data.kernel_decode.setArg( 7, interval[0] );
+   data.kernel_decode.setArg( 8, interval[1] );
+   data.kernel_decode.setArg( 9, data.max_size );
+   data.kernel_decode.setArg( 10, data.slot_size );
+   data.kernel_decode.setArg( 11, data.buffer_program );
+   data.kernel_decode.setArg( 12, data.buffer_offset );
+   data.kernel_decode.setArg( 13, data.buffer_size );
+   data.kernel_decode.setArg( 14, data.buffer_length );
+   data.kernel_decode.setArg( 15, data.population_size );
+   data.kernel_decode.setArg( 16, sizeof( cl_mem ), NULL ); // No neutral individuals (see acc_evolve_init)
+
+   return 0;
+}
+
+// -----------------------------------------------------------------------------
+void acc_decode( const GENOME_TYPE* const* genomes, int nInd, int* size, int* length )
+{
+   if( nInd == 0 ) return;
+
+   /* Only the genomes themselves are transferred (packed back to back); the
+      decoded programs stay on the device, where they are evaluated. */
+   const size_t genome_bytes = data.number_of_words * sizeof( GENOME_TYPE );
+   GENOME_TYPE* staging = (GENOME_TYPE*) data.queue.enqueueMapBuffer( data.buffer_genomes, CL_TRUE, CL_MAP_WRITE, 0, nInd * genome_bytes );
+   for( int k = 0; k < nInd; ++k ) memcpy( staging + k * data.number_of_words, genomes[k], genome_bytes );
+   data.queue.enqueueUnmapMemObject( data.buffer_genomes, staging );
+
+   data.kernel_decode.setArg( 15, nInd );
+   try {
+      data.queue.enqueueNDRangeKernel( data.kernel_decode, cl::NDRange(), cl::NDRange( (unsigned) ( ceil( nInd/(float) data.local_size_decode ) * data.local_size_decode ) ), cl::NDRange( data.local_size_decode ) );
+   }
+   catch( cl::Error& e )
+   {
+      cerr << "\nERROR(decode): " << e.what() << " ( " << e.err() << " )\n";
+      throw;
+   }
+
+   // The sizes are still needed on the host (complexity penalization), and so are the lengths (introns)
+   data.queue.enqueueReadBuffer( data.buffer_size, CL_FALSE, 0, nInd * sizeof( int ), size );
+   data.queue.enqueueReadBuffer( data.buffer_length, CL_TRUE, 0, nInd * sizeof( int ), length );
+}
+
+// -----------------------------------------------------------------------------
+int acc_evolve_init( int number_of_bits, int bits_per_gene, int tournament_size, float crossover_rate, float mutation_rate, float twopoint_probability, float bitflip_probability, float aggressive_shrink_probability, const uint64_t* seeds )
+{
+   if( !data.number_of_words )
+   {
+      fprintf(stderr, "The device evolution requires the device decoding.\n");
+      return 1;
+   }
+
+   data.current = 0;
+
+   /* Two populations (parents and offspring, swapped every generation), one
+      RNG state (two words) per pair of offspring */
+   const int number_of_pairs = (data.population_size + 1) / 2;
+   for( int k = 0; k < 2; ++k )
+   {
+      data.buffer_population[k] = cl::Buffer( data.context, CL_MEM_READ_WRITE, data.population_size * data.number_of_words * sizeof( GENOME_TYPE ) );
+      data.buffer_population_fitness[k] = cl::Buffer( data.context, CL_MEM_READ_WRITE, data.population_size * sizeof( float ) );
+      data.buffer_population_length[k] = cl::Buffer( data.context, CL_MEM_READ_WRITE, data.population_size * sizeof( int ) );
+   }
+   data.buffer_neutral = cl::Buffer( data.context, CL_MEM_READ_WRITE, data.population_size * sizeof( cl_uchar ) );
+   data.buffer_rng = cl::Buffer( data.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, 2 * number_of_pairs * sizeof( cl_ulong ), (void*) seeds );
+
+   data.kernel_generate.setArg( 1, data.buffer_neutral );
+   data.kernel_generate.setArg( 2, data.number_of_words );
+   data.kernel_generate.setArg( 3, (cl_ulong) genome_tail_mask( number_of_bits ) );
+   data.kernel_generate.setArg( 4, data.buffer_rng );
+   data.kernel_generate.setArg( 5, data.population_size );
+
+   data.kernel_breed.setArg( 6, data.buffer_neutral );
+   data.kernel_breed.setArg( 7, data.buffer_rng );
+   data.kernel_breed.setArg( 8, data.number_of_words );
+   data.kernel_breed.setArg( 9, number_of_bits );
+   data.kernel_breed.setArg( 10, bits_per_gene );
+   data.kernel_breed.setArg( 11, tournament_size );
+   data.kernel_breed.setArg( 12, crossover_rate );
+   data.kernel_breed.setArg( 13, mutation_rate );
+   data.kernel_breed.setArg( 14, twopoint_probability );
+   data.kernel_breed.setArg( 15, bitflip_probability );
+   data.kernel_breed.setArg( 16, aggressive_shrink_probability );
+   data.kernel_breed.setArg( 18, data.population_size );
+
+   data.kernel_fitness.setArg( 0, data.buffer_vector );
+   data.kernel_fitness.setArg( 1, data.buffer_size );
+   data.kernel_fitness.setArg( 2, data.buffer_neutral );
+   data.kernel_fitness.setArg( 4, data.nlin );
+   data.kernel_fitness.setArg( 7, data.population_size );
+
+   // The neutral individuals are not decoded (they keep their inherited fitness)
+   data.kernel_decode.setArg( 16, data.buffer_neutral );
+
+   data.local_size_evolve = data.local_size_decode;
+   data.local_size_evolve = std::min( data.local_size_evolve, (unsigned) data.kernel_breed.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>( data.device ) );
+   data.local_size_evolve = std::min( data.local_size_evolve, (unsigned) data.kernel_fitness.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>( data.device ) );
+
+   return 0;
+}
+
+// -----------------------------------------------------------------------------
+void acc_generate()
+{
+   const unsigned number_of_pairs = (data.population_size + 1) / 2;
+
+   data.kernel_generate.setArg( 0, data.buffer_population[data.current] );
+   try {
+      data.queue.enqueueNDRangeKernel( data.kernel_generate, cl::NDRange(), cl::NDRange( (unsigned) ( ceil( number_of_pairs/(float) data.local_size_evolve ) * data.local_size_evolve ) ), cl::NDRange( data.local_size_evolve ) );
+   }
+   catch( cl::Error& e )
+   {
+      cerr << "\nERROR(generate): " << e.what() << " ( " << e.err() << " )\n";
+      throw;
+   }
+}
+
+// -----------------------------------------------------------------------------
+void acc_breed( int nImmigrants, const GENOME_TYPE* const* immigrants, const GENOME_TYPE* elite, float elite_fitness, int elite_length )
+{
+   const int parents = data.current, offspring = 1 - data.current;
+   const size_t genome_bytes = data.number_of_words * sizeof( GENOME_TYPE );
+
+   /* The immigrants come first (and have to be evaluated), followed by the
+      elite individual, which keeps its fitness */
+   for( int k = 0; k < nImmigrants; ++k )
+   {
+      data.queue.enqueueWriteBuffer( data.buffer_population[offspring], CL_TRUE, k * genome_bytes, genome_bytes, immigrants[k] );
+   }
+   int first = nImmigrants;
+   if( elite )
+   {
+      data.queue.enqueueWriteBuffer( data.buffer_population[offspring], CL_TRUE, first * genome_bytes, genome_bytes, elite );
+      data.queue.enqueueWriteBuffer( data.buffer_population_fitness[offspring], CL_TRUE, first * sizeof( float ), sizeof( float ), &elite_fitness );
+      data.queue.enqueueWriteBuffer( data.buffer_population_length[offspring], CL_TRUE, first * sizeof( int ), sizeof( int ), &elite_length );
+      ++first;
+   }
+   if( first > 0 )
+   {
+      std::vector<cl_uchar> neutral( first, 0 );
+      if( elite ) neutral[first - 1] = 1;
+      data.queue.enqueueWriteBuffer( data.buffer_neutral, CL_TRUE, 0, first * sizeof( cl_uchar ), &neutral[0] );
+   }
+
+   const unsigned number_of_pairs = (data.population_size - first + 1) / 2;
+   if( number_of_pairs > 0 )
+   {
+      data.kernel_breed.setArg( 0, data.buffer_population[parents] );
+      data.kernel_breed.setArg( 1, data.buffer_population_fitness[parents] );
+      data.kernel_breed.setArg( 2, data.buffer_population_length[parents] );
+      data.kernel_breed.setArg( 3, data.buffer_population[offspring] );
+      data.kernel_breed.setArg( 4, data.buffer_population_fitness[offspring] );
+      data.kernel_breed.setArg( 5, data.buffer_population_length[offspring] );
+      data.kernel_breed.setArg( 17, first );
+      try {
+         data.queue.enqueueNDRangeKernel( data.kernel_breed, cl::NDRange(), cl::NDRange( (unsigned) ( ceil( number_of_pairs/(float) data.local_size_evolve ) * data.local_size_evolve ) ), cl::NDRange( data.local_size_evolve ) );
+      }
+      catch( cl::Error& e )
       {
-         if( Opts.String.Get("-type") == "GPU" || Opts.String.Get("-type") == "gpu" )
-         {
-            type = CL_DEVICE_TYPE_GPU;
-         }
-         else
-         {
-            fprintf(stderr, "Not a single compatible device found.\n");
-            return 1;
-         }
+         cerr << "\nERROR(breed): " << e.what() << " ( " << e.err() << " )\n";
+         throw;
       }
    }
 
-   if( ncol < 0 )
+   data.current = offspring;
+}
+
+// -----------------------------------------------------------------------------
+void acc_evaluate( float alpha, int* index, int* best_size )
+{
+   const int cur = data.current;
+
+   select_variant( 0 ); // The programs are decoded right on the device
+
+   unsigned global_size1, global_size2;
+   adjust_ranges( data.population_size, 0, &global_size1, &global_size2 );
+
+   data.kernel_decode.setArg( 0, data.buffer_population[cur] );
+   data.kernel_decode.setArg( 14, data.buffer_population_length[cur] );
+   data.kernel_decode.setArg( 15, data.population_size );
+
+   data.kernel_fitness.setArg( 3, data.buffer_population_fitness[cur] );
+   data.kernel_fitness.setArg( 5, data.strategy == "DP" ? (int) (global_size1 / data.local_size1) : 0 );
+   data.kernel_fitness.setArg( 6, alpha );
+
+   data.kernel2.setArg( 0, data.buffer_population_fitness[cur] );
+   data.kernel2.setArg( 5, sizeof( cl_mem ), NULL ); // Already fitnesses
+   request_best( data.population_size, best_size );
+
+   try {
+      data.queue.enqueueNDRangeKernel( data.kernel_decode, cl::NDRange(), cl::NDRange( (unsigned) ( ceil( data.population_size/(float) data.local_size_decode ) * data.local_size_decode ) ), cl::NDRange( data.local_size_decode ) );
+      data.queue.enqueueNDRangeKernel( data.kernel1, cl::NDRange(), cl::NDRange( global_size1 ), cl::NDRange( data.local_size1 ) );
+      data.queue.enqueueNDRangeKernel( data.kernel_fitness, cl::NDRange(), cl::NDRange( (unsigned) ( ceil( data.population_size/(float) data.local_size_evolve ) * data.local_size_evolve ) ), cl::NDRange( data.local_size_evolve ) );
+      data.queue.enqueueNDRangeKernel( data.kernel2, cl::NDRange(), cl::NDRange( global_size2 ), cl::NDRange( data.local_size2 ) );
+   }
+   catch( cl::Error& e )
    {
-      fprintf(stderr, "Missing number of columns of dataset.\n");
-      return 1;
+      cerr << "\nERROR(evaluate): " << e.what() << " ( " << e.err() << " )\n";
+      throw;
+   }
+
+   pick_best( global_size2, index, best_size );
+}
+
+// -----------------------------------------------------------------------------
+void acc_fetch( int idx, GENOME_TYPE* genome, float* fitness, int* length )
+{
+   const size_t genome_bytes = data.number_of_words * sizeof( GENOME_TYPE );
+
+   if( genome ) data.queue.enqueueReadBuffer( data.buffer_population[data.current], CL_FALSE, idx * genome_bytes, genome_bytes, genome );
+   data.queue.enqueueReadBuffer( data.buffer_population_length[data.current], CL_FALSE, idx * sizeof( int ), sizeof( int ), length );
+   data.queue.enqueueReadBuffer( data.buffer_population_fitness[data.current], CL_TRUE, idx * sizeof( float ), sizeof( float ), fitness );
+}
+
+// -----------------------------------------------------------------------------
+void acc_fetch_population( GENOME_TYPE* const* genomes, float* fitness )
+{
+   const size_t genome_bytes = data.number_of_words * sizeof( GENOME_TYPE );
+
+   data.queue.enqueueReadBuffer( data.buffer_population_fitness[data.current], CL_FALSE, 0, data.population_size * sizeof( float ), fitness );
+   GENOME_TYPE* staging = (GENOME_TYPE*) data.queue.enqueueMapBuffer( data.buffer_population[data.current], CL_TRUE, CL_MAP_READ, 0, data.population_size * genome_bytes );
+   for( int k = 0; k < data.population_size; ++k ) memcpy( genomes[k], staging + k * data.number_of_words, genome_bytes );
+   data.queue.enqueueUnmapMemObject( data.buffer_population[data.current], staging );
+}
+
+// -----------------------------------------------------------------------------
+void acc_staging( unsigned total_size, Instruction** program, int** offset, int** size )
+{
+   if( !data.staged_offset )
+   {
+      if( !data.staging_offset() )
+      {
+         data.staging_offset = cl::Buffer( data.context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, (data.population_size + 1) * sizeof( int ) );
+         data.staging_size = cl::Buffer( data.context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, data.population_size * sizeof( int ) );
+      }
+      data.staged_offset = (int*) data.queue.enqueueMapBuffer( data.staging_offset, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, (data.population_size + 1) * sizeof( int ) );
+      data.staged_size = (int*) data.queue.enqueueMapBuffer( data.staging_size, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, data.population_size * sizeof( int ) );
    }
 
-   if ( opencl_init( Opts.Int.Get("-cl-p"), Opts.Int.Get("-cl-d"), type ) )
+   // The contents of the programs are not kept when the buffer is enlarged
+   if( total_size > data.staging_capacity )
    {
-      fprintf(stderr,"Error in OpenCL initialization phase.\n");
-      return 1;
+      if( data.staged_program ) { data.queue.enqueueUnmapMemObject( data.staging_program, data.staged_program ); data.staged_program = NULL; }
+      data.staging_capacity = std::max( total_size, 2 * data.staging_capacity );
+      data.staging_program = cl::Buffer( data.context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, data.staging_capacity * sizeof( Instruction ) );
    }
+   if( !data.staged_program )
+   {
+      data.staged_program = (Instruction*) data.queue.enqueueMapBuffer( data.staging_program, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, data.staging_capacity * sizeof( Instruction ) );
+   }
+
+   *program = data.staged_program; *offset = data.staged_offset; *size = data.staged_size;
+}
 
-   if ( build_kernel( Opts.Int.Get("-cl-mls"), ppp_mode, prediction_mode ) )
+// -----------------------------------------------------------------------------
+void acc_batches_init( int number_of_batches )
+{
+   data.buffer_batch_program.resize( number_of_batches );
+   data.buffer_batch_offset.resize( number_of_batches );
+   data.buffer_batch_size.resize( number_of_batches );
+   data.buffer_batch_vector.resize( number_of_batches );
+   data.batch_capacity.assign( number_of_batches, 0 );
+   data.batch_vector_capacity.assign( number_of_batches, 0 );
+   data.batch_nInd.assign( number_of_batches, 0 );
+   data.batch_partials.assign( number_of_batches, 0 );
+   data.batch_errors.resize( number_of_batches );
+   data.batch_done.resize( number_of_batches );
+}
+
+// -----------------------------------------------------------------------------
+void acc_stack_depth( int depth )
+{
+   data.stack_depth = depth;
+}
+
+// -----------------------------------------------------------------------------
+void acc_submit( int batch, const Instruction* program, const int* offset, const int* size, int nInd )
+{
+   select_variant( data.stack_depth ); data.stack_depth = 0;
+
+   data.batch_nInd[batch] = nInd;
+   if( nInd == 0 ) return;
+
+   const unsigned total_size = std::max( offset[nInd], 1 ); // A zero-sized transfer would be an error
+   if( total_size > data.batch_capacity[batch] )
    {
-      fprintf(stderr,"Error in build the kernel.\n");
-      return 1;
+      if( data.batch_capacity[batch] == 0 )
+      {
+         data.buffer_batch_offset[batch] = cl::Buffer( data.context, CL_MEM_READ_ONLY, data.population_size * sizeof( int ) );
+         data.buffer_batch_size[batch] = cl::Buffer( data.context, CL_MEM_READ_ONLY, data.population_size * sizeof( int ) );
+      }
+      data.batch_capacity[batch] = std::max( total_size, 2 * data.batch_capacity[batch] );
+      data.buffer_batch_program[batch] = cl::Buffer( data.context, CL_MEM_READ_ONLY, data.batch_capacity[batch] * sizeof( Instruction ) );
    }
 
-   create_buffers( input, ncol, ppp_mode, prediction_mode );
+   unsigned global_size1, global_size2;
+   adjust_ranges( nInd, 1, &global_size1, &global_size2 ); // No kernel2: the fitnesses come back anyway
 
-//   try
-//   {
-//   }
-//   catch( cl::Error& e )
-//   {
-//      cerr << "ERROR: " << e.what() << " ( " << e.err() << " )\n";
-//   }
+   /* Each batch has its own output, so that the kernel of the next batch
+      doesn't have to wait for the errors of this one to be read back */
+   data.batch_partials[batch] = data.strategy == "DP" ? global_size1 / data.local_size1 : 0;
+   data.batch_errors[batch].resize( nInd * std::max( data.batch_partials[batch], 1 ) );
+   if( data.batch_errors[batch].size() > data.batch_vector_capacity[batch] )
+   {
+      data.batch_vector_capacity[batch] = data.batch_errors[batch].size();
+      data.buffer_batch_vector[batch] = cl::Buffer( data.context, CL_MEM_WRITE_ONLY, data.batch_vector_capacity[batch] * sizeof( float ) );
+   }
 
-   return 0;
+   /* Nothing here blocks: the host buffers are only reused after the batch
+      has been waited for (acc_wait). The transfers go through their own
+      queue, so that they overlap with the evaluation of the previous batch. */
+   std::vector<cl::Event> writes(3);
+   data.transfer_queue.enqueueWriteBuffer( data.buffer_batch_program[batch], CL_FALSE, 0, total_size * sizeof( Instruction ), program, NULL, &writes[0] );
+   data.transfer_queue.enqueueWriteBuffer( data.buffer_batch_offset[batch], CL_FALSE, 0, nInd * sizeof( int ), offset, NULL, &writes[1] );
+   data.transfer_queue.enqueueWriteBuffer( data.buffer_batch_size[batch], CL_FALSE, 0, nInd * sizeof( int ), size, NULL, &writes[2] );
+   data.transfer_queue.flush();
+
+   data.kernel1.setArg( 0, data.buffer_batch_program[batch] );
+   data.kernel1.setArg( 1, data.buffer_batch_offset[batch] );
+   data.kernel1.setArg( 2, data.buffer_batch_size[batch] );
+   data.kernel1.setArg( 4, data.buffer_batch_vector[batch] );
+
+   std::vector<cl::Event> evaluated(1);
+   try {
+      data.queue.enqueueNDRangeKernel( data.kernel1, cl::NDRange(), cl::NDRange( global_size1 ), cl::NDRange( data.local_size1 ), &writes, &evaluated[0] );
+   }
+   catch( cl::Error& e )
+   {
+      cerr << "\nERROR(kernel1): " << e.what() << " ( " << e.err() << " )\n";
+      throw;
+   }
+   // The arguments are captured when enqueued; acc_interpret uses the regular buffers
+   data.kernel1.setArg( 0, data.buffer_program );
+   data.kernel1.setArg( 1, data.buffer_offset );
+   data.kernel1.setArg( 2, data.buffer_size );
+   data.kernel1.setArg( 4, data.buffer_vector );
+   data.queue.flush();
+
+   data.transfer_queue.enqueueReadBuffer( data.buffer_batch_vector[batch], CL_FALSE, 0, data.batch_errors[batch].size() * sizeof( float ), &data.batch_errors[batch][0], &evaluated, &data.batch_done[batch] );
+   data.transfer_queue.flush();
+}
+
+// -----------------------------------------------------------------------------
+void acc_wait( int batch, float* vector, const int* size, float alpha, int* index, int* best_size )
+{
+   const int nInd = data.batch_nInd[batch];
+   if( nInd == 0 ) { *best_size = 0; return; }
+
+   data.batch_done[batch].wait();
+
+   reduce_errors( &data.batch_errors[batch][0], data.batch_partials[batch], nInd, size, alpha, vector );
+
+   if( *best_size > nInd ) { *best_size = nInd; }
+   util::PickNBest( *best_size, index, nInd, vector );
 }
 
 // -----------------------------------------------------------------------------
-void acc_interpret( Symbol* phenotype, float* ephemeral, int* size,
+void acc_interpret( Instruction* program, int* offset, int* size,
 #ifdef PROFILING
 unsigned long sum_size_gen,
 #endif
-float* vector, int nInd, void (*send)(Population*), int (*receive)(GENOME_TYPE**), Population* migrants, int* nImmigrants, int* index, int* best_size, int ppp_mode, int prediction_mode, float alpha )
+float* vector, int nInd, void (*send)(Population*), int (*receive)(Population*), Population* migrants, int* nImmigrants, int* index, int* best_size, int ppp_mode, int prediction_mode, float alpha )
 {
 #ifdef PROFILING
    std::vector<cl::Event> events(6); 
@@ -667,38 +1874,176 @@ float* vector, int nInd, void (*send)(Population*), int (*receive)(GENOME_TYPE**
    data.time_gen_communication_receive2 = 0.0;
 #endif
 
-   data.queue.enqueueWriteBuffer( data.buffer_phenotype, CL_TRUE, 0, data.max_size * nInd * sizeof( Symbol ), phenotype, NULL
+   /* With several devices, the population is split among them; their set up
+      waits for the first evaluation, after the autotuning (if any) */
+   if( data.device_list.size() > 1 && program && !ppp_mode )
+   {
+#ifdef PROFILING
+      util::Timer t_devices;
+#endif
+      if( data.devices.empty() && devices_init( data.device_list, data.max_local_size ) )
+      {
+         fprintf(stderr, "Using the first device only.\n");
+         data.device_list.resize( 1 ); data.devices.clear();
+         return acc_interpret( program, offset, size,
+#ifdef PROFILING
+         sum_size_gen,
+#endif
+         vector, nInd, send, receive, migrants, nImmigrants, index, best_size, ppp_mode, prediction_mode, alpha );
+      }
+      interpret_devices( program, offset, size, vector, nInd, send, receive, migrants, nImmigrants, index, best_size, alpha );
+      data.stack_depth = 0;
+#ifdef PROFILING
+      data.time_gen_kernel1   = t_devices.elapsed();
+      data.time_total_kernel1 += data.time_gen_kernel1;
+      data.gpops_gen_kernel = data.gpops_gen_communication = (sum_size_gen * data.nlin) / data.time_gen_kernel1;
+#endif
+      return;
+   }
+
+   /* The fused kernels pay off only when a single best individual is wanted;
+      otherwise kernel2 runs anyway, so the plain ones are used from now on */
+   if( fusing() && !ppp_mode && *best_size > 1 )
+   {
+      if( data.verbose ) std::cout << "More than one best individual: -fused ignored" << std::endl;
+      data.fused = false;
+      setup_kernels( data.max_local_size, 0 );
+      create_result_buffers( 0, 0 );
+   }
+
+   // The depth of the programs decoded on the device is not known
+   select_variant( program ? data.stack_depth : 0 ); data.stack_depth = 0;
+
+   /* HYBRID: the programs longer than the threshold are evaluated by the PDP
+      kernel and, at the same time, the others by the PP one. Only the offsets
+      and sizes are reordered, the long ones first, so that each kernel takes
+      a contiguous range; 'hybrid_order' gives the individual of each entry.
+      (The programs decoded on the device are left to the PDP kernel alone.) */
+   const bool hybrid = data.strategy == "HYBRID" && program && !ppp_mode;
+   int nLong = 0; double instructions = 0.0;
+   if( hybrid )
+   {
+      data.hybrid_order.resize( nInd ); data.hybrid_offset.resize( nInd ); data.hybrid_size.resize( nInd );
+      for( int i = 0; i < nInd; i++ ) { if( size[i] > data.hybrid_threshold ) nLong++; instructions += size[i]; }
+
+      int l = 0, s = nLong;
+      for( int i = 0; i < nInd; i++ ) data.hybrid_order[size[i] > data.hybrid_threshold ? l++ : s++] = i;
+      for( int k = 0; k < nInd; k++ ) { data.hybrid_offset[k] = offset[data.hybrid_order[k]]; data.hybrid_size[k] = size[data.hybrid_order[k]]; }
+   }
+
+   /* Only the words actually used by the (packed) programs are transferred.
+      When no programs are given they have already been decoded on the device
+      (see acc_decode), right into the buffers used by the kernels. */
+   const bool zero_copy = program && program == data.staged_program && data.zero_copy && !hybrid;
+   if( zero_copy )
+   {
+      /* The programs are already in the staging buffers (see acc_staging),
+         which the kernel reads in place: they just have to be unmapped */
+      data.queue.enqueueUnmapMemObject( data.staging_program, data.staged_program, NULL
+#ifdef PROFILING
+      , &events[0]
+#endif
+      );
+      data.queue.enqueueUnmapMemObject( data.staging_offset, data.staged_offset, NULL
+#ifdef PROFILING
+      , &events[1]
+#endif
+      );
+      data.queue.enqueueUnmapMemObject( data.staging_size, data.staged_size, NULL
 #ifdef PROFILING
-   , &events[0]
+      , &events[2]
 #endif
-   );
+      );
+      data.staged_program = NULL; data.staged_offset = NULL; data.staged_size = NULL;
+
+      data.kernel1.setArg( 0, data.staging_program );
+      data.kernel1.setArg( 1, data.staging_offset );
+      data.kernel1.setArg( 2, data.staging_size );
+      if( data.strategy == "DP" ) data.kernel_reduce.setArg( 1, data.staging_size ); else if( !ppp_mode ) data.kernel2.setArg( 5, data.staging_size );
+   }
+   else
+   {
+      if( program )
+      {
+         const unsigned total_size = std::max( offset[nInd], 1 ); // A zero-sized transfer would be an error
+         reserve_programs( total_size );
 
-   data.queue.enqueueWriteBuffer( data.buffer_ephemeral, CL_TRUE, 0, data.max_size * nInd * sizeof( float ), ephemeral, NULL
+         // NB: from (pinned) staging memory, these are plain DMA transfers
+         data.queue.enqueueWriteBuffer( data.buffer_program, CL_TRUE, 0, total_size * sizeof( Instruction ), program, NULL
 #ifdef PROFILING
-   , &events[1]
+         , &events[0]
 #endif
-   );
+         );
 
-   data.queue.enqueueWriteBuffer( data.buffer_size, CL_TRUE, 0, nInd * sizeof( int ), size, NULL
+         data.queue.enqueueWriteBuffer( data.buffer_offset, CL_TRUE, 0, nInd * sizeof( int ), hybrid ? &data.hybrid_offset[0] : offset, NULL
 #ifdef PROFILING
-   , &events[2]
+         , &events[1]
 #endif
-   );
+         );
 
-   if( data.strategy == "DP" ) 
+         data.queue.enqueueWriteBuffer( data.buffer_size, CL_TRUE, 0, nInd * sizeof( int ), hybrid ? &data.hybrid_size[0] : size, NULL
+#ifdef PROFILING
+         , &events[2]
+#endif
+         );
+      }
+
+      data.kernel1.setArg( 0, data.buffer_program );
+      data.kernel1.setArg( 1, data.buffer_offset );
+      data.kernel1.setArg( 2, data.buffer_size );
+      if( data.strategy == "DP" ) data.kernel_reduce.setArg( 1, data.buffer_size ); else if( !ppp_mode ) data.kernel2.setArg( 5, data.buffer_size );
+   }
+
+   unsigned global_size1, global_size2;
+   adjust_ranges( nInd, ppp_mode, &global_size1, &global_size2 );
+   if( !ppp_mode ) request_best( nInd, best_size );
+   // PP and PDP: kernel2 ranks the errors penalized as the fitnesses (and as the fused kernel1)
+   if( !ppp_mode && data.strategy != "DP" ) data.kernel2.setArg( 6, alpha );
+
+   /* Fused evaluation: kernel1 folds the penalization into the fitnesses and
+      keeps the best one, so kernel2 is not needed */
+   const bool fused = fusing() && !ppp_mode;
+   if( fusing() )
    {
-      data.kernel1.setArg( 9, nInd );
+      static const cl_ulong none = CL_ULONG_MAX;
+      data.kernel1.setArg( 10, alpha );
+      data.queue.enqueueWriteBuffer( data.buffer_best, CL_FALSE, 0, sizeof( cl_ulong ), &none );
    }
 
+   std::vector<cl::Event> hybrid_events;
    //std::cerr << "Global size: " << data.global_size1 << " Local size: " << data.local_size1 << " Work group: " << data.global_size1/data.local_size1 << std::endl;
    try {
-      // ---------- begin kernel execution
-      data.queue.enqueueNDRangeKernel( data.kernel1, cl::NDRange(), cl::NDRange( data.global_size1 ), cl::NDRange( data.local_size1 ), NULL
+      if( hybrid )
+      {
+         hybrid_events.reserve( 2 );
+         if( nLong > 0 ) // PDP: one work-group per long program
+         {
+            hybrid_events.push_back( cl::Event() );
+            data.queue.enqueueNDRangeKernel( data.kernel1, cl::NDRange(), cl::NDRange( nLong * data.local_size1 ), cl::NDRange( data.local_size1 ), NULL, &hybrid_events.back() );
+            data.queue.flush();
+         }
+         if( nLong < nInd ) // PP: one work-item per short program, starting at 'nLong'
+         {
+            data.kernel_pp.setArg( 0, data.buffer_program );
+            data.kernel_pp.setArg( 1, data.buffer_offset );
+            data.kernel_pp.setArg( 2, data.buffer_size );
+            data.kernel_pp.setArg( 8, nInd );
+
+            hybrid_events.push_back( cl::Event() );
+            data.hybrid_queue.enqueueNDRangeKernel( data.kernel_pp, cl::NDRange( nLong ), cl::NDRange( (unsigned) ( ceil( (nInd - nLong)/(float) data.local_size_pp ) * data.local_size_pp ) ), cl::NDRange( data.local_size_pp ), NULL, &hybrid_events.back() );
+            data.hybrid_queue.flush();
+         }
+      }
+      else
+      {
+         // ---------- begin kernel execution
+         data.queue.enqueueNDRangeKernel( data.kernel1, cl::NDRange(), cl::NDRange( global_size1 ), cl::NDRange( data.local_size1 ), NULL
 #ifdef PROFILING
-      , &events[3]
+         , &events[3]
 #endif
-      );
-      // ---------- end kernel execution
+         );
+         // ---------- end kernel execution
+      }
    }
    catch( cl::Error& e )
    {
@@ -711,39 +2056,82 @@ float* vector, int nInd, void (*send)(Population*), int (*receive)(GENOME_TYPE**
    // tem que criar uma segunda fila
    // TODO: data.queuetransfer.enqueuReadBuffer( data.buffer_vector, CL_FALSE, 0, size_which_depends_on_the_strategy, tmp, event0, &event4);
 
-   if ( !ppp_mode )
+   /* DP: the partial errors are reduced on the device too, right into the
+      fitnesses (buffer_error), which is all kernel2 and the host need */
+   if( data.strategy == "DP" && !(ppp_mode && prediction_mode) )
    {
-      if( data.strategy == "PDP" || data.strategy == "PP" ) 
+      data.kernel_reduce.setArg( 5, alpha );
+      data.kernel_reduce.setArg( 6, nInd );
+      try
       {
-         //std::cerr << "Global size: " << data.global_size2 << " Local size: " << data.local_size2 << " Work group: " << data.global_size2/data.local_size2 << std::endl;
-         try 
-         {
-            // ---------- begin kernel execution
-            data.queue.enqueueNDRangeKernel( data.kernel2, cl::NDRange(), cl::NDRange( data.global_size2 ), cl::NDRange( data.local_size2 ), NULL
+         data.queue.enqueueNDRangeKernel( data.kernel_reduce, cl::NDRange(), cl::NDRange( nInd ), cl::NullRange, NULL
 #ifdef PROFILING
-            , &events[4]
+         , &events[5]
 #endif
-            );
-            // ---------- end kernel execution
-         }
-         catch( cl::Error& e )
-         {
-            cerr << "\nERROR(kernel2): " << e.what() << " ( " << e.err() << " )\n";
-            throw;
-         }
+         );
+      }
+      catch( cl::Error& e )
+      {
+         cerr << "\nERROR(reduce_dp): " << e.what() << " ( " << e.err() << " )\n";
+         throw;
+      }
+   }
+
+   /* HYBRID: kernel2 would see the fitnesses in the order of the kernels, so
+      the best ones are picked on the host, once merged back (see below) */
+   if ( !ppp_mode && !fused && !hybrid )
+   {
+      //std::cerr << "Global size: " << data.global_size2 << " Local size: " << data.local_size2 << " Work group: " << data.global_size2/data.local_size2 << std::endl;
+      try 
+      {
+         // ---------- begin kernel execution
+         data.queue.enqueueNDRangeKernel( data.kernel2, cl::NDRange(), cl::NDRange( global_size2 ), cl::NDRange( data.local_size2 ), NULL
+#ifdef PROFILING
+         , &events[4]
+#endif
+         );
+         // ---------- end kernel execution
+      }
+      catch( cl::Error& e )
+      {
+         cerr << "\nERROR(kernel2): " << e.what() << " ( " << e.err() << " )\n";
+         throw;
       }
       data.queue.flush();
    }
+   else if( fused ) data.queue.flush();
 
    if( !ppp_mode )
    {
       send( migrants );
-      *nImmigrants = receive( migrants->genome );
+      *nImmigrants = receive( migrants );
    }
 
    // Wait until the kernel has finished
    data.queue.finish();
+   if( hybrid )
+   {
+      cl::Event::waitForEvents( hybrid_events );
+
+      cl_ulong first = std::numeric_limits<cl_ulong>::max(), last = 0, start, end;
+      for( unsigned e = 0; e < hybrid_events.size(); ++e )
+      {
+         hybrid_events[e].getProfilingInfo( CL_PROFILING_COMMAND_START, &start );
+         hybrid_events[e].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
+         first = std::min( first, start ); last = std::max( last, end );
+      }
+#ifdef PROFILING
+      data.time_gen_kernel1   += (last - first)/1.0E9;
+      data.time_total_kernel1 += (last - first)/1.0E9;
+#endif
+      adapt_threshold( (last - first) / std::max( instructions, 1.0 ), nLong, nInd );
+   }
 
+   if( zero_copy )
+   {
+      // Back to the host (the sizes are still needed below)
+      acc_staging( 0, &program, &offset, &size );
+   }
 
    // TODO: data.queuetransfer.finish();
    float *tmp;
@@ -758,97 +2146,35 @@ float* vector, int nInd, void (*send)(Population*), int (*receive)(GENOME_TYPE**
       if( data.strategy == "DP" ) 
       {
          // -----------------------------------------------------------------------
-         /*
-            Each kernel execution will put in data.buffer_vector the partial errors of each individual:
-
-            |  0 |  0 |     |  0    ||   1 |  1 |     |  1   |     |  ind-1 |  ind-1 |     |  ind-1 |
-            | E  | E  | ... | E     ||  E  | E  | ... | E    | ... | E      | E      | ... | E      |        
-            |  0 |  1 |     |  n-1  ||   0 |  1 |     |  n-1 |     |  0     |  1     |     |  n-1   |    
-
-            where 'ind-1' is the index of the last individual, and 'n-1' is the index of the
-            last 'partial error', that is, 'n-1' is the index of the last work-group (gr_id).
-          */
+         /* The partial errors of each individual (see reduce_errors) have
+            already been reduced by reduce_dp: just the fitnesses come back */
 
 #ifdef PROFILING
          util::Timer t_time;
 #endif
-         const unsigned num_work_groups = data.global_size1 / data.local_size1;
-
-         // The line below maps the contents of 'data_buffer_vector' into 'tmp'.
-         // essa linha some
-         tmp = (float*) data.queue.enqueueMapBuffer( data.buffer_vector, CL_TRUE, CL_MAP_READ, 0, num_work_groups * nInd * sizeof( float ), NULL );
-
-         // Reduction on host!
-         for( int i = 0; i < nInd; i++)
-         {
-            float sum = 0.0f;
-            for( int gr_id = 0; gr_id < num_work_groups; gr_id++ ) 
-            {
-               float error = tmp[i * num_work_groups + gr_id];
-
-               // Avoid further calculations if the current one has overflown the float
-               // (i.e., it is inf or NaN).
-               if( isinf(error) || isnan(error) ) { sum = std::numeric_limits<float>::max(); break; }
-
-#ifdef REDUCEMAX
-               sum = (error*data.nlin > sum) ? error*data.nlin : sum;
-#else
-               sum += error;
-#endif
-            }
-
-            if( isnan( sum ) || isinf( sum ) )
-               vector[i] = std::numeric_limits<float>::max();
-            else
-               vector[i] = sum/data.nlin + alpha * size[i];
-         }
-
-         //essa linha some
-         data.queue.enqueueUnmapMemObject( data.buffer_vector, tmp, NULL );
+         data.queue.enqueueReadBuffer( data.buffer_error, CL_TRUE, 0, nInd * sizeof( float ), vector );
 
 #ifdef PROFILING
          data.time_gen_communication_receive1   += t_time.elapsed();
          data.time_total_communication_receive1 += t_time.elapsed();
 #endif
-
-         data.queue.enqueueWriteBuffer( data.buffer_error, CL_TRUE, 0, data.population_size * sizeof( float ), vector, NULL
-#ifdef PROFILING
-         , &events[5]
-#endif
-         );
-
-         if( !ppp_mode )
-         {
-            //std::cerr << "Global size: " << data.global_size2 << " Local size: " << data.local_size2 << " Work group: " << data.global_size2/data.local_size2 << std::endl;
-            try
-            {
-               // ---------- begin kernel execution
-               data.queue.enqueueNDRangeKernel( data.kernel2, cl::NDRange(), cl::NDRange( data.global_size2 ), cl::NDRange( data.local_size2 ), NULL
-#ifdef PROFILING
-               , &events[4]
-#endif
-               );
-               // ---------- end kernel execution
-            }
-            catch( cl::Error& e )
-            {
-               cerr << "\nERROR(kernel2): " << e.what() << " ( " << e.err() << " )\n";
-               throw;
-            }
-    
-            // Wait until the kernel has finished
-         }
-         data.queue.finish();
       }
       else
       {
-         if( data.strategy == "PDP" || data.strategy == "PP" ) 
+         if( data.strategy == "PDP" || data.strategy == "PP" || data.strategy == "HYBRID" ) 
          {
 #ifdef PROFILING
             util::Timer t_time;
 #endif
             tmp = (float*) data.queue.enqueueMapBuffer( data.buffer_vector, CL_TRUE, CL_MAP_READ, 0, nInd * sizeof( float ), NULL );
-            for( int i = 0; i < nInd; i++ ) { vector[i] = tmp[i] + alpha * size[i]; }
+            if( hybrid ) // Merged back into the order of the individuals
+            {
+               for( int k = 0; k < nInd; k++ ) { const int i = data.hybrid_order[k]; vector[i] = tmp[k] + alpha * size[i]; }
+            }
+            else
+            {
+               reduce_errors( tmp, 0, nInd, size, alpha, vector );
+            }
 
             //printf("%f\n", vector[0]);
             // substitui as duas linhas de cima
@@ -870,19 +2196,20 @@ float* vector, int nInd, void (*send)(Population*), int (*receive)(GENOME_TYPE**
 #ifdef PROFILING
          util::Timer t_time;
 #endif
-         const unsigned num_work_groups2 = data.global_size2 / data.local_size2;
-   
-         // The line below maps the contents of 'data_buffer_pb' and 'data_buffer_pi' into 'PB' and 'PI', respectively.
-         float* PB = (float*) data.queue.enqueueMapBuffer( data.buffer_pb, CL_TRUE, CL_MAP_READ, 0, num_work_groups2 * sizeof( float ), NULL );
-         int* PI = (int*) data.queue.enqueueMapBuffer( data.buffer_pi, CL_TRUE, CL_MAP_READ, 0, num_work_groups2 * sizeof( int ), NULL );
-   
-         if( *best_size > num_work_groups2 ) { *best_size = num_work_groups2; }
-         
-         /* Reduction on host of the per-group partial reductions performed by kernel2. */
-         util::PickNBest(*best_size, index, num_work_groups2, PB, PI);
+         /* Selection on host of the best ones among the per-group best ones
+            given by kernel2 (or just the one kept by the fused kernel1, or
+            among all the fitnesses with HYBRID) */
+         if( fused )
+         {
+            cl_ulong key;
+            data.queue.enqueueReadBuffer( data.buffer_best, CL_TRUE, 0, sizeof( cl_ulong ), &key );
+            index[0] = key_index( key );
+         }
+         else if( hybrid )
+            util::PickNBest( *best_size, index, nInd, vector );
+         else
+            pick_best( global_size2, index, best_size );
 
-         data.queue.enqueueUnmapMemObject( data.buffer_pb, PB, NULL );
-         data.queue.enqueueUnmapMemObject( data.buffer_pi, PI, NULL );
 
 #ifdef PROFILING
          data.time_gen_communication_receive2   += t_time.elapsed();
@@ -897,34 +2224,40 @@ float* vector, int nInd, void (*send)(Population*), int (*receive)(GENOME_TYPE**
    cl_ulong start, end;
    cl_ulong min = std::numeric_limits<float>::max(), max = 0.;
 
-   events[0].getProfilingInfo( CL_PROFILING_COMMAND_QUEUED, &start );
-   events[0].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
-   if( start < min ) { min = start; }
-   if( end > max )   { max = end; }
-
-   events[1].getProfilingInfo( CL_PROFILING_COMMAND_QUEUED, &start );
-   events[1].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
-   if( start < min ) { min = start; }
-   if( end > max )   { max = end; }
-
-   events[2].getProfilingInfo( CL_PROFILING_COMMAND_QUEUED, &start );
-   events[2].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
-   if( start < min ) { min = start; }
-   if( end > max )   { max = end; }
-
-   data.time_gen_communication_send1   += (max - min)/1.0E9; 
-   data.time_total_communication_send1 += (max - min)/1.0E9; 
+   if( program )
+   {
+      events[0].getProfilingInfo( CL_PROFILING_COMMAND_QUEUED, &start );
+      events[0].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
+      if( start < min ) { min = start; }
+      if( end > max )   { max = end; }
+
+      events[1].getProfilingInfo( CL_PROFILING_COMMAND_QUEUED, &start );
+      events[1].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
+      if( start < min ) { min = start; }
+      if( end > max )   { max = end; }
+
+      events[2].getProfilingInfo( CL_PROFILING_COMMAND_QUEUED, &start );
+      events[2].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
+      if( start < min ) { min = start; }
+      if( end > max )   { max = end; }
+
+      data.time_gen_communication_send1   += (max - min)/1.0E9; 
+      data.time_total_communication_send1 += (max - min)/1.0E9; 
+   }
    
-   events[3].getProfilingInfo( CL_PROFILING_COMMAND_START, &start );
-   events[3].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
-   data.time_gen_kernel1   += (end - start)/1.0E9;
-   data.time_total_kernel1 += (end - start)/1.0E9;
+   if( !hybrid ) // Otherwise already accounted for (see adapt_threshold)
+   {
+      events[3].getProfilingInfo( CL_PROFILING_COMMAND_START, &start );
+      events[3].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
+      data.time_gen_kernel1   += (end - start)/1.0E9;
+      data.time_total_kernel1 += (end - start)/1.0E9;
+   }
 
    data.time_total_communication1 += data.time_gen_communication_send1 + data.time_gen_communication_receive1;
    data.gpops_gen_kernel = (sum_size_gen * data.nlin) / data.time_gen_kernel1;
    data.gpops_gen_communication = (sum_size_gen * data.nlin) / (data.time_gen_kernel1 + data.time_gen_communication_send1 + data.time_gen_communication_receive1);
 
-   if( !ppp_mode )
+   if( !ppp_mode && !fused && !hybrid )
    {
       events[4].getProfilingInfo( CL_PROFILING_COMMAND_START, &start );
       events[4].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
@@ -932,12 +2265,12 @@ float* vector, int nInd, void (*send)(Population*), int (*receive)(GENOME_TYPE**
       data.time_total_kernel2 += (end - start)/1.0E9;
    }
 
-   if( !prediction_mode && data.strategy == "DP" ) 
+   if( !(ppp_mode && prediction_mode) && data.strategy == "DP" ) // reduce_dp, the second stage
    {
-      events[5].getProfilingInfo( CL_PROFILING_COMMAND_QUEUED, &start );
+      events[5].getProfilingInfo( CL_PROFILING_COMMAND_START, &start );
       events[5].getProfilingInfo( CL_PROFILING_COMMAND_END, &end );
-      data.time_gen_communication_send2   += (end - start)/1.0E9;
-      data.time_total_communication_send2 += (end - start)/1.0E9;
+      data.time_gen_kernel2   += (end - start)/1.0E9;
+      data.time_total_kernel2 += (end - start)/1.0E9;
    }
 #endif
 }
@@ -1,11 +1,49 @@
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
 #include <symbol>
 
 #include <definitions.h>
 
 #include <functions.h>
 
-__kernel void
-evaluate_pp( __global const Symbol* phenotype, __global const float* ephemeral, __global const int* size, __global const float* inputs, __global float* vector, int nlin, int ncol, int prediction_mode, int population_size )
+#ifdef cl_khr_int64_base_atomics
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+#endif
+
+/* Key of the individual 'index' of the given fitness: the fitness mapped to
+ * an unsigned integer of the same order (upper half) and the complement of
+ * the index (lower half), so that the smallest key is the one of the best
+ * individual and, as in util::PickNBest, ties go to the largest index. */
+ulong
+fitness_key( float fitness, int index )
+{
+   uint bits = as_uint( fitness );
+   bits ^= (bits >> 31) ? 0xFFFFFFFFu : 0x80000000u; // Negative ones are reversed
+   return ((ulong) bits << 32) | ~(uint) index;
+}
+
+#ifdef cl_khr_int64_base_atomics
+/* Keeps in '*best' the smallest key given so far (compare-and-swap loop) */
+void
+update_best( __global ulong* best, ulong key )
+{
+   ulong current = *best;
+   while( key < current )
+   {
+      ulong previous = atom_cmpxchg( (volatile __global ulong*) best, current, key );
+      if( previous == current ) break;
+      current = previous;
+   }
+}
+#endif
+
+/* PP (and PDP, below) evaluation: when 'best' is given, the fitness of each
+ * individual, i.e. its error plus the penalty 'alpha' * size, also updates the
+ * best key (see update_best), which makes best_individuals unnecessary. */
+void
+pp( __global const Instruction* program, __global const int* offset, __global const int* size, __global const float* inputs, __global float* vector, int nlin, int ncol, int prediction_mode, int population_size, __global ulong* best, float alpha )
 {
    // Include the cost matrix definition if given
    #include <costmatrix>
@@ -30,20 +68,20 @@ evaluate_pp( __global const Symbol* phenotype, __global const float* ephemeral,
             stack_top = -1;
             for( int i = size[gl_id] - 1; i >= 0; --i )
             {
-               switch( phenotype[gl_id * MAX_PHENOTYPE_SIZE + i] )
+               switch( OPCODE( program[offset[gl_id] + i] ) )
                {
                   #include <interpreter_core>
 
                   case T_ATTRIBUTE:
 #ifdef TRANSPOSE
-                     stack[++stack_top] = inputs[n + nlin * (int)ephemeral[gl_id * MAX_PHENOTYPE_SIZE + i]];
+                     stack[++stack_top] = inputs[n + INPUT_STRIDE * OPERAND( program[offset[gl_id] + i] )];
 #else
-                     stack[++stack_top] = inputs[n * ncol + (int)ephemeral[gl_id * MAX_PHENOTYPE_SIZE + i]];
+                     stack[++stack_top] = inputs[n * ncol + OPERAND( program[offset[gl_id] + i] )];
 #endif
                      break;
 #ifndef NOT_USING_T_CONST
                   case T_CONST:
-                     stack[++stack_top] = ephemeral[gl_id * MAX_PHENOTYPE_SIZE + i];
+                     stack[++stack_top] = as_float( program[offset[gl_id] + size[gl_id] + OPERAND( program[offset[gl_id] + i] )] );
                      break;
 #endif
                   default:
@@ -54,7 +92,7 @@ evaluate_pp( __global const Symbol* phenotype, __global const float* ephemeral,
             if( !prediction_mode )
             {
 #ifdef TRANSPOSE
-               float error = ERROR( stack[stack_top], inputs[n + nlin * (ncol - 1)] );
+               float error = ERROR( stack[stack_top], inputs[n + INPUT_STRIDE * (ncol - 1)] );
 #else
                float error = ERROR( stack[stack_top], inputs[n * ncol + (ncol - 1)] );
 #endif
@@ -82,11 +120,29 @@ evaluate_pp( __global const Symbol* phenotype, __global const float* ephemeral,
                vector[gl_id] = PE/nlin;
          }
       }
+#ifdef cl_khr_int64_base_atomics
+      if( best && !prediction_mode ) update_best( best, fitness_key( vector[gl_id] + alpha * size[gl_id], gl_id ) );
+#endif
    }
 }
 
 __kernel void
-evaluate_dp( __global const Symbol* phenotype, __global const float* ephemeral, __global const int* size, __global const float* inputs, __global float* vector, int nlin, int ncol, int prediction_mode, __local float* PE, int nInd )
+evaluate_pp( __global const Instruction* program, __global const int* offset, __global const int* size, __global const float* inputs, __global float* vector, int nlin, int ncol, int prediction_mode, int population_size )
+{
+   pp( program, offset, size, inputs, vector, nlin, ncol, prediction_mode, population_size, 0, 0.0f );
+}
+
+#ifdef cl_khr_int64_base_atomics
+/* Evaluation fused with the selection of the best individual */
+__kernel void
+evaluate_pp_best( __global const Instruction* program, __global const int* offset, __global const int* size, __global const float* inputs, __global float* vector, int nlin, int ncol, int prediction_mode, int population_size, __global ulong* best, float alpha )
+{
+   pp( program, offset, size, inputs, vector, nlin, ncol, prediction_mode, population_size, best, alpha );
+}
+#endif
+
+__kernel void
+evaluate_dp( __global const Instruction* program, __global const int* offset, __global const int* size, __global const float* inputs, __global float* vector, int nlin, int ncol, int prediction_mode, __local float* PE, int nInd )
 {
    // Include the cost matrix definition if given
    #include <costmatrix>
@@ -118,20 +174,20 @@ evaluate_dp( __global const Symbol* phenotype, __global const float* ephemeral,
          stack_top = -1;
          for( int i = size[ind] - 1; i >= 0; --i )
          {
-            switch( phenotype[ind * MAX_PHENOTYPE_SIZE + i] )
+            switch( OPCODE( program[offset[ind] + i] ) )
             {
                #include <interpreter_core>
 
                case T_ATTRIBUTE:
 #ifdef TRANSPOSE
-                  stack[++stack_top] = inputs[(gr_id * lo_size + lo_id) + nlin * (int)ephemeral[ind * MAX_PHENOTYPE_SIZE + i]];
+                  stack[++stack_top] = inputs[(gr_id * lo_size + lo_id) + INPUT_STRIDE * OPERAND( program[offset[ind] + i] )];
 #else
-                  stack[++stack_top] = inputs[(gr_id * lo_size + lo_id) * ncol + (int)ephemeral[ind * MAX_PHENOTYPE_SIZE + i]];
+                  stack[++stack_top] = inputs[(gr_id * lo_size + lo_id) * ncol + OPERAND( program[offset[ind] + i] )];
 #endif
                   break;
 #ifndef NOT_USING_T_CONST
                case T_CONST:
-                  stack[++stack_top] = ephemeral[ind * MAX_PHENOTYPE_SIZE + i];
+                  stack[++stack_top] = as_float( program[offset[ind] + size[ind] + OPERAND( program[offset[ind] + i] )] );
                   break;
 #endif
                default:
@@ -142,7 +198,7 @@ evaluate_dp( __global const Symbol* phenotype, __global const float* ephemeral,
          if( !prediction_mode )
          {
 #ifdef TRANSPOSE
-            PE[lo_id] = ERROR( stack[stack_top], inputs[(gr_id * lo_size + lo_id) + nlin * (ncol - 1)] );
+            PE[lo_id] = ERROR( stack[stack_top], inputs[(gr_id * lo_size + lo_id) + INPUT_STRIDE * (ncol - 1)] );
 #else
             PE[lo_id] = ERROR( stack[stack_top], inputs[(gr_id * lo_size + lo_id) * ncol + (ncol - 1)] );
 #endif
@@ -170,8 +226,8 @@ evaluate_dp( __global const Symbol* phenotype, __global const float* ephemeral,
    }
 }
 
-__kernel void
-evaluate_pdp( __global const Symbol* phenotype, __global const float* ephemeral, __global const int* size, __global const float* inputs, __global float* vector, int nlin, int ncol, int prediction_mode, __local float* PE )
+void
+pdp( __global const Instruction* program, __global const int* offset, __global const int* size, __global const float* inputs, __global float* vector, int nlin, int ncol, int prediction_mode, __local float* PE, __global ulong* best, float alpha )
 {
    // Include the cost matrix definition if given
    #include <costmatrix>
@@ -201,20 +257,20 @@ evaluate_pdp( __global const Symbol* phenotype, __global const float* ephemeral,
             stack_top = -1;
             for( int i = size[gr_id] - 1; i >= 0; --i )
             {
-               switch( phenotype[gr_id * MAX_PHENOTYPE_SIZE + i] )
+               switch( OPCODE( program[offset[gr_id] + i] ) )
                {
                   #include <interpreter_core>
 
                   case T_ATTRIBUTE:
 #ifdef TRANSPOSE
-                     stack[++stack_top] = inputs[n + nlin * (int)ephemeral[gr_id * MAX_PHENOTYPE_SIZE + i]];
+                     stack[++stack_top] = inputs[n + INPUT_STRIDE * OPERAND( program[offset[gr_id] + i] )];
 #else
-                     stack[++stack_top] = inputs[n * ncol + (int)ephemeral[gr_id * MAX_PHENOTYPE_SIZE + i]];
+                     stack[++stack_top] = inputs[n * ncol + OPERAND( program[offset[gr_id] + i] )];
 #endif
                      break;
 #ifndef NOT_USING_T_CONST
                   case T_CONST:
-                     stack[++stack_top] = ephemeral[gr_id * MAX_PHENOTYPE_SIZE + i];
+                     stack[++stack_top] = as_float( program[offset[gr_id] + size[gr_id] + OPERAND( program[offset[gr_id] + i] )] );
                      break;
 #endif
                   default:
@@ -225,7 +281,7 @@ evaluate_pdp( __global const Symbol* phenotype, __global const float* ephemeral,
             if( !prediction_mode )
             {
 #ifdef TRANSPOSE
-               float error = ERROR( stack[stack_top], inputs[n + nlin * (ncol - 1)] );
+               float error = ERROR( stack[stack_top], inputs[n + INPUT_STRIDE * (ncol - 1)] );
 #else
                float error = ERROR( stack[stack_top], inputs[n * ncol + (ncol - 1)] );
 #endif
@@ -265,49 +321,463 @@ evaluate_pdp( __global const Symbol* phenotype, __global const float* ephemeral,
             vector[gr_id] = ( isinf( PE[0] ) || isnan( PE[0] ) ) ? MAXFLOAT : PE[0]/nlin;
       }
    }
+#ifdef cl_khr_int64_base_atomics
+   if( best && !prediction_mode && lo_id == 0 ) update_best( best, fitness_key( vector[gr_id] + alpha * size[gr_id], gr_id ) );
+#endif
+}
+
+__kernel void
+evaluate_pdp( __global const Instruction* program, __global const int* offset, __global const int* size, __global const float* inputs, __global float* vector, int nlin, int ncol, int prediction_mode, __local float* PE )
+{
+   pdp( program, offset, size, inputs, vector, nlin, ncol, prediction_mode, PE, 0, 0.0f );
+}
+
+#ifdef cl_khr_int64_base_atomics
+/* Evaluation fused with the selection of the best individual */
+__kernel void
+evaluate_pdp_best( __global const Instruction* program, __global const int* offset, __global const int* size, __global const float* inputs, __global float* vector, int nlin, int ncol, int prediction_mode, __local float* PE, __global ulong* best, float alpha )
+{
+   pdp( program, offset, size, inputs, vector, nlin, ncol, prediction_mode, PE, best, alpha );
 }
+#endif
 
+/* Top-k selection: every work-group sorts (bitonic sort in local memory, so
+ * the local size must be a power of two) the keys of its individuals, i.e.,
+ * their fitnesses and indices (see fitness_key), and writes the first (best) 'k' of
+ * them into candidates[gr_id * k ...]. The host then picks the best 'k' among
+ * all the candidates; each key gives both the index and the fitness.
+ *
+ * If 'size' is given, 'vector' holds the errors (PP and PDP), which are
+ * penalized by 'alpha' per instruction just as the host does; otherwise it
+ * holds the fitnesses already (DP, see reduce_dp, and the device evolution). */
 __kernel void
-best_individual( __global const float* vector, __global float* PB, __global int* PI, __local float* lo_best, __local int* lo_idx, int population_size )
+best_individuals( __global const float* vector, __global ulong* candidates, __local ulong* keys, int population_size, int k, __global const int* size, float alpha )
 {
    int lo_id = get_local_id(0);
    int gr_id = get_group_id(0);
    int gl_id = get_global_id(0);
 
    int lo_size = get_local_size(0);
-   int next_power_of_2 = (pown(2.0f, (int) ceil(log2((float)lo_size))))/2;
 
    if( gl_id < population_size )
    {
-      lo_best[lo_id] = vector[gr_id * lo_size + lo_id];
-      lo_idx[lo_id]  = gr_id * lo_size + lo_id;
+      keys[lo_id] = fitness_key( size ? vector[gl_id] + alpha * size[gl_id] : vector[gl_id], gl_id );
    }
    else
    {
-      lo_best[lo_id] = MAXFLOAT;
+      keys[lo_id] = ~0UL;
    }
 
-   for( int s = next_power_of_2; s > 0; s/=2 )
+   for( int size = 2; size <= lo_size; size *= 2 )
    {
-      barrier(CLK_LOCAL_MEM_FENCE);
-      if( (lo_id < s) && (lo_id + s < lo_size) ) 
-      { 
-         if( lo_best[lo_id] > lo_best[lo_id + s] )
-         //if( lo_best[lo_id] < lo_best[lo_id + s] )
+      for( int stride = size/2; stride > 0; stride /= 2 )
+      {
+         barrier(CLK_LOCAL_MEM_FENCE);
+         int partner = lo_id ^ stride;
+         if( partner > lo_id )
+         {
+            ulong a = keys[lo_id], b = keys[partner];
+            if( (a > b) == ((lo_id & size) == 0) ) { keys[lo_id] = b; keys[partner] = a; }
+         }
+      }
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   if( lo_id < k ) candidates[gr_id * k + lo_id] = keys[lo_id];
+}
+
+/* Returns the 'n' (n <= 64) consecutive alleles starting at 'pos' as an
+ * integral value, where the allele at 'pos' is the least significant bit (the
+ * same as genome_extract of the host). */
+ulong
+extract_alleles( __global const ulong* genome, int pos, int n )
+{
+   const int w = pos / 64, b = pos % 64;
+
+   ulong value = genome[w] >> b;
+   if( b + n > 64 ) value |= genome[w + 1] << (64 - b);
+
+   return n < 64 ? value & ((1UL << n) - 1) : value;
+}
+
+/* Decodes the (bit-packed) genomes of 'nInd' individuals into their programs,
+ * one work-item per individual. It does exactly what decode() does on the
+ * host, but with an explicit stack of pending symbols instead of recursion.
+ *
+ * 'grammar' holds, for each non-terminal 'nt', the index of its first rule
+ * (grammar[2*nt]) and its number of rules (grammar[2*nt+1]); each rule is
+ * then its number of symbols followed by MAX_RULE_SIZE symbols. It is read
+ * from the constant memory, unless it is too large for it (see
+ * acc_decode_init).
+ *
+ * The program of the individual 'k' is written into the slot starting at
+ * offset[k] = k * slot_size: its instructions first, then its constant pool
+ * (which is built in the second half of the slot and moved right after the
+ * instructions at the end). A program that does not fit into its slot (or
+ * whose pending symbols overflow the stack) is "killed", i.e., its size is 0.
+ * The number of coding alleles of each genome is written into 'length'.
+ *
+ * If 'neutral' is given, the individuals flagged in it are not decoded (see
+ * the device-resident evolution below). */
+#ifndef GRAMMAR_SPACE
+#define GRAMMAR_SPACE __constant
+#endif
+__kernel void
+decode( __global const ulong* genomes, int number_of_words, GRAMMAR_SPACE const int* grammar, int initial_symbol, int number_of_bits, int bits_per_gene, int bits_per_constant, float min, float max, int max_size, int slot_size, __global Instruction* program, __global int* offset, __global int* size, __global int* length, int nInd, __global const uchar* neutral )
+{
+   int pending[MAX_DECODE_STACK_SIZE];
+   int top = -1;
+
+   int gl_id = get_global_id(0);
+
+   if( gl_id < nInd && neutral && neutral[gl_id] )
+   {
+      // A neutral individual keeps the fitness (and length) it inherited: nothing to evaluate
+      offset[gl_id] = gl_id * slot_size;
+      size[gl_id] = 0;
+   }
+   else if( gl_id < nInd )
+   {
+      __global const ulong* genome = genomes + gl_id * number_of_words;
+      __global Instruction* code = program + gl_id * slot_size;
+      const int capacity = slot_size / 2;
+
+      int allele = 0, pos = 0, num_constants = 0;
+      bool killed = false;
+
+      pending[++top] = initial_symbol;
+      while( top >= 0 )
+      {
+         const int symbol = pending[top--];
+
+         if( symbol >= TERMINAL_MIN )
+         {
+            if( pos >= capacity ) { killed = true; break; }
+#ifndef NOT_USING_T_CONST
+            if( symbol == T_CONST )
+            {
+               // Returns the constant zero if there are not enough bits
+               float value = 0.0f;
+               if( allele + bits_per_constant <= number_of_bits )
+               {
+                  ulong raw = extract_alleles( genome, allele, bits_per_constant );
+                  allele += bits_per_constant;
+#ifdef cl_khr_fp64
+                  value = (float) (min + (double) ((float) raw * (max - min)) / ((1UL << bits_per_constant) - 1.0));
+#else
+                  value = min + (float) raw * (max - min) / ((1UL << bits_per_constant) - 1.0f);
+#endif
+               }
+               if( num_constants > MAX_OPERAND ) { killed = true; break; }
+
+               code[capacity + num_constants] = as_uint( value );
+               code[pos++] = INSTRUCTION( T_CONST, num_constants++ );
+            }
+            else
+#endif
+            if( symbol >= ATTRIBUTE_MIN )
+               code[pos++] = INSTRUCTION( T_ATTRIBUTE, symbol - ATTRIBUTE_MIN );
+            else
+               code[pos++] = INSTRUCTION( symbol, 0 );
+         }
+         else // It's a non-terminal: picks one of its rules
+         {
+            if( allele + bits_per_gene > number_of_bits ) { killed = true; break; }
+
+            uint raw = (uint) extract_alleles( genome, allele, bits_per_gene );
+            allele += bits_per_gene;
+
+            if( pos >= max_size ) { killed = true; break; }
+
+            GRAMMAR_SPACE const int* rule = grammar + grammar[2 * symbol] + (raw % grammar[2 * symbol + 1]) * (MAX_RULE_SIZE + 1);
+            if( top + rule[0] >= MAX_DECODE_STACK_SIZE ) { killed = true; break; }
+
+            // The symbols are stacked backwards, so that the first one is expanded first
+            for( int i = rule[0]; i > 0; --i ) pending[++top] = rule[i];
+         }
+      }
+
+      if( killed ) { pos = 0; num_constants = 0; }
+
+      for( int i = 0; i < num_constants; ++i ) code[pos + i] = code[capacity + i];
+
+      offset[gl_id] = gl_id * slot_size;
+      size[gl_id] = pos;
+      length[gl_id] = allele;
+   }
+}
+
+/** ****************************************************************** **/
+/** ******************** DEVICE-RESIDENT EVOLUTION ******************* **/
+/** ****************************************************************** **/
+
+/* The populations live on the device as 'population_size' genomes of
+ * 'number_of_words' words each, back to back, along with their fitnesses,
+ * lengths (coding alleles) and neutral flags; these kernels do on the device
+ * what ppi_generate_population, ppi_tournament, ppi_crossover, ppi_mutation
+ * and ppi_clone do on the host. Each work-item breeds a pair of offspring
+ * and has its own state of the XorShift128+ generator ('rng'). */
+
+ulong
+random_int64( __global ulong* rng )
+{
+   ulong x = rng[0];
+   const ulong y = rng[1];
+   rng[0] = y;
+   x ^= x << 23;
+   rng[1] = x ^ y ^ (x >> 17) ^ (y >> 26);
+   return rng[1] + y;
+}
+
+/* Uniform random real in [0,1) */
+float
+random_real( __global ulong* rng )
+{
+   return (random_int64( rng ) >> 40) * (1.0f / 16777216.0f);
+}
+
+/* Uniform random integer in [0,n) */
+int
+random_int( __global ulong* rng, int n )
+{
+   return min( (int) (random_real( rng ) * n), n - 1 );
+}
+
+/* Writes the 'n' (n <= 64) least significant bits of 'value' into the alleles
+ * [pos, pos + n) (the same as genome_deposit of the host) */
+void
+deposit_alleles( __global ulong* genome, int pos, int n, ulong value )
+{
+   const int w = pos / 64, b = pos % 64;
+   const ulong mask = n < 64 ? (1UL << n) - 1 : ~0UL;
+
+   value &= mask;
+   genome[w] = (genome[w] & ~(mask << b)) | (value << b);
+   if( b + n > 64 )
+   {
+      const int s = 64 - b;
+      genome[w + 1] = (genome[w + 1] & ~(mask >> s)) | (value >> s);
+   }
+}
+
+/* Copies 'base' into 'dst', but with the alleles [begin, end) taken from 'other' */
+void
+combine( __global ulong* dst, __global const ulong* base, __global const ulong* other, int begin, int end, int number_of_words )
+{
+   for( int w = 0; w < number_of_words; ++w )
+   {
+      const int lo = w * 64;
+      ulong mask = 0UL;
+      if( begin < lo + 64 && end > lo )
+      {
+         mask = begin > lo ? ~0UL << (begin - lo) : ~0UL;
+         if( end - lo < 64 ) mask &= (1UL << (end - lo)) - 1;
+      }
+      dst[w] = (base[w] & ~mask) | (other[w] & mask);
+   }
+}
+
+int
+tournament( __global const float* fitness, int tournament_size, int population_size, __global ulong* rng )
+{
+   int idx_winner = random_int( rng, population_size );
+   float fitness_winner = fitness[idx_winner];
+
+   for( int t = 1; t < tournament_size; ++t )
+   {
+      const int idx_competitor = random_int( rng, population_size );
+      if( fitness[idx_competitor] < fitness_winner )
+      {
+         fitness_winner = fitness[idx_competitor];
+         idx_winner = idx_competitor;
+      }
+   }
+
+   return idx_winner;
+}
+
+/* Bit-flip or shrink mutation of the individual 'idx' (see ppi_mutation) */
+void
+mutation( __global ulong* genome, __global const int* length, __global uchar* neutral, int idx, int number_of_bits, int bits_per_gene, float mutation_rate, float bitflip_probability, float aggressive_shrink_probability, __global ulong* rng )
+{
+   const int max_bits_mutated = ceil( mutation_rate * number_of_bits );
+   int num_bits_mutated = (int) (random_real( rng ) * (max_bits_mutated + 1));
+
+   if( num_bits_mutated == 0 ) return;
+
+   bool is_neutral = neutral[idx];
+
+   if( random_real( rng ) < bitflip_probability )
+   {
+      while( num_bits_mutated-- > 0 )
+      {
+         const int bit = random_int( rng, number_of_bits );
+         genome[bit / 64] ^= 1UL << (bit % 64);
+         is_neutral = is_neutral && bit >= length[idx];
+      }
+   }
+   else
+   {
+      if( random_real( rng ) < aggressive_shrink_probability )
+         num_bits_mutated = random_int( rng, number_of_bits );
+
+      const int number_of_bits_to_shrink = (num_bits_mutated + (bits_per_gene - 1)) / bits_per_gene * bits_per_gene;
+      const int start = random_int( rng, number_of_bits ) / bits_per_gene * bits_per_gene;
+      const int end = min( start + number_of_bits_to_shrink, number_of_bits );
+
+      // Bit-level memmove (overlapping), moving up to a word at a time
+      int to = start, from = end, n = number_of_bits - end;
+      while( n > 0 )
+      {
+         const int chunk = min( 64 - to % 64, n );
+         deposit_alleles( genome, to, chunk, extract_alleles( genome, from, chunk ) );
+         to += chunk; from += chunk; n -= chunk;
+      }
+      is_neutral = is_neutral && start >= length[idx];
+   }
+
+   neutral[idx] = is_neutral;
+}
+
+/* Random initial population; every individual has to be evaluated */
+__kernel void
+generate( __global ulong* genomes, __global uchar* neutral, int number_of_words, ulong tail_mask, __global ulong* rng, int population_size )
+{
+   int gl_id = get_global_id(0);
+
+   for( int idx = 2 * gl_id; idx < min( 2 * gl_id + 2, population_size ); ++idx )
+   {
+      __global ulong* genome = genomes + idx * number_of_words;
+      for( int w = 0; w < number_of_words; ++w ) genome[w] = random_int64( rng + 2 * gl_id );
+      genome[number_of_words - 1] &= tail_mask;
+      neutral[idx] = 0;
+   }
+}
+
+/* Breeds the offspring [first, population_size) of the 'parents', two by
+ * two: tournament selection, then one- or two-point crossover (or cloning)
+ * and, finally, mutation. An offspring is flagged as neutral (and inherits
+ * its parent's fitness and length) when its coding alleles are the same as
+ * the ones of its parent. */
+__kernel void
+breed( __global const ulong* parents, __global const float* parents_fitness, __global const int* parents_length, __global ulong* offspring, __global float* fitness, __global int* length, __global uchar* neutral, __global ulong* rng, int number_of_words, int number_of_bits, int bits_per_gene, int tournament_size, float crossover_rate, float mutation_rate, float twopoint_probability, float bitflip_probability, float aggressive_shrink_probability, int first, int population_size )
+{
+   int gl_id = get_global_id(0);
+   const int i = first + 2 * gl_id;
+
+   if( i < population_size )
+   {
+      __global ulong* state = rng + 2 * gl_id;
+      const bool pair = i < population_size - 1;
+
+      const int idx_father = tournament( parents_fitness, tournament_size, population_size, state );
+      const int idx_mother = tournament( parents_fitness, tournament_size, population_size, state );
+
+      __global const ulong* father = parents + idx_father * number_of_words;
+      __global const ulong* mother = parents + idx_mother * number_of_words;
+
+      if( random_real( state ) < crossover_rate )
+      {
+         const bool same = idx_father == idx_mother;
+         int begin, end;
+         bool two_points = random_real( state ) < twopoint_probability;
+         if( two_points )
+         {
+            // Cuts only at the boundaries of the genes
+            begin = random_int( state, number_of_bits ) / bits_per_gene * bits_per_gene;
+            end   = random_int( state, number_of_bits ) / bits_per_gene * bits_per_gene;
+            if( begin > end ) { int tmp = begin; begin = end; end = tmp; }
+         }
+         else
          {
-         //   lo_best[lo_id] = lo_best[lo_id]; 
-         //   lo_idx[lo_id]  = lo_idx[lo_id];
-         //}
-         //else
-         //{
-            lo_best[lo_id] = lo_best[lo_id + s]; 
-            lo_idx[lo_id]  = lo_idx[lo_id + s];
+            begin = random_int( state, number_of_bits ); end = number_of_bits;
+         }
+
+         /* A single offspring (the last one of an odd population) is the
+            second one, as on the host */
+         const bool neutral1 = same || (two_points && begin == end) || begin >= parents_length[idx_father];
+         const bool neutral2 = same || (two_points && begin == end) || begin >= parents_length[idx_mother];
+         if( pair )
+         {
+            combine( offspring + i * number_of_words, father, mother, begin, end, number_of_words );
+            neutral[i] = neutral1;
+            if( neutral1 ) { fitness[i] = parents_fitness[idx_father]; length[i] = parents_length[idx_father]; }
+         }
+         const int j = pair ? i + 1 : i;
+         combine( offspring + j * number_of_words, mother, father, begin, end, number_of_words );
+         neutral[j] = neutral2;
+         if( neutral2 ) { fitness[j] = parents_fitness[idx_mother]; length[j] = parents_length[idx_mother]; }
+      }
+      else // The offspring are clones of their parents
+      {
+         for( int w = 0; w < number_of_words; ++w ) offspring[i * number_of_words + w] = father[w];
+         neutral[i] = 1; fitness[i] = parents_fitness[idx_father]; length[i] = parents_length[idx_father];
+         if( pair )
+         {
+            for( int w = 0; w < number_of_words; ++w ) offspring[(i + 1) * number_of_words + w] = mother[w];
+            neutral[i + 1] = 1; fitness[i + 1] = parents_fitness[idx_mother]; length[i + 1] = parents_length[idx_mother];
          }
       }
+
+      mutation( offspring + i * number_of_words, length, neutral, i, number_of_bits, bits_per_gene, mutation_rate, bitflip_probability, aggressive_shrink_probability, state );
+      if( pair )
+         mutation( offspring + (i + 1) * number_of_words, length, neutral, i + 1, number_of_bits, bits_per_gene, mutation_rate, bitflip_probability, aggressive_shrink_probability, state );
    }
-   if( lo_id == 0) 
-   { 
-      PB[gr_id] = lo_best[0]; 
-      PI[gr_id] = lo_idx[0]; 
+}
+
+/* Fitness of the individual 'i' out of its 'num_partials' partial errors
+ * computed by evaluate_dp (one per work-group), just like the host does in
+ * reduce_errors: inf and NaN become MAXFLOAT. */
+float
+reduce_partials( __global const float* vector, int i, int num_partials, int nlin, float penalty )
+{
+   float sum = 0.0f;
+   for( int gr_id = 0; gr_id < num_partials; ++gr_id )
+   {
+      float error = vector[i * num_partials + gr_id];
+
+      // Avoid further calculations if the current one has overflown the float
+      // (i.e., it is inf or NaN).
+      if( isinf(error) || isnan(error) ) { sum = MAXFLOAT; break; }
+
+#ifdef REDUCEMAX
+      sum = (error*nlin > sum) ? error*nlin : sum;
+#else
+      sum += error;
+#endif
+   }
+   return ( isnan( sum ) || isinf( sum ) ) ? MAXFLOAT : sum/nlin + penalty;
+}
+
+/* Second stage of the DP strategy: reduces the partial errors of each
+ * individual into its fitness, which is then used in place by
+ * best_individuals (only the fitnesses come back to the host). */
+__kernel void
+reduce_dp( __global const float* vector, __global const int* size, __global float* fitness, int nlin, int num_partials, float alpha, int nInd )
+{
+   int gl_id = get_global_id(0);
+
+   if( gl_id < nInd ) fitness[gl_id] = reduce_partials( vector, gl_id, num_partials, nlin, alpha * size[gl_id] );
+}
+
+/* Fitness of the (non-neutral) individuals out of the errors computed by the
+ * evaluation kernels: one average error per individual (PP and PDP, when
+ * 'num_partials' is 0) or the partial errors of each work-group (DP), which
+ * are reduced here just like in reduce_dp. */
+__kernel void
+fitness( __global const float* vector, __global const int* size, __global const uchar* neutral, __global float* fitness, int nlin, int num_partials, float alpha, int nInd )
+{
+   int gl_id = get_global_id(0);
+
+   if( gl_id < nInd && !neutral[gl_id] )
+   {
+      if( num_partials == 0 )
+      {
+         fitness[gl_id] = vector[gl_id] + alpha * size[gl_id];
+      }
+      else
+      {
+         fitness[gl_id] = reduce_partials( vector, gl_id, num_partials, nlin, alpha * size[gl_id] );
+      }
    }
 }
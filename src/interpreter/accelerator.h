@@ -18,6 +18,7 @@
 
 #include <definitions.h>
 #include <symbol>
+#include "../util/Dataset.h"
 #include "../individual"
 
 namespace ppi {
@@ -28,18 +29,142 @@ namespace ppi {
 /** ************************************************************************************************** **/
 /**                                                                                                    **/
 /** ************************************************************************************************** **/
-int acc_interpret_init( int argc, char** argv, const unsigned size, const unsigned max_arity, const unsigned population_size, float** input, int nlin, int ncol, int ppp_mode, int prediction_mode );
+int acc_interpret_init( int argc, char** argv, const unsigned size, const unsigned max_arity, const unsigned population_size, const util::Dataset& input, int ppp_mode, int prediction_mode );
+
+/** ************************************************************************************************** **/
+/** ************************************* Function autotune ****************************************** **/
+/** ************************************************************************************************** **/
+/** With -autotune, and no decision for this device and problem in the tuning file yet, times the     **/
+/** evaluation of the given 'nInd' programs (packed as for acc_interpret) with every strategy and a   **/
+/** range of local sizes, keeps the fastest and appends it to the tuning file. Otherwise (or once     **/
+/** done) it does nothing. It must be called right after acc_interpret_init.                          **/
+/** ************************************************************************************************** **/
+int acc_autotune( const Instruction* program, const int* offset, const int* size, int nInd );
+
+/** ************************************************************************************************** **/
+/** ************************************ Function autotuning ***************************************** **/
+/** ************************************************************************************************** **/
+/** Whether acc_autotune is still due (i.e., the programs to be timed are needed).                     **/
+/** ************************************************************************************************** **/
+bool acc_autotuning();
+
+/** ************************************************************************************************** **/
+/** ********************************** Function decode_init ****************************************** **/
+/** ************************************************************************************************** **/
+/** Enables the decoding of the genomes on the device (see acc_decode). 'grammar' is the flat form of  **/
+/** the grammar, as described in the decode kernel (accelerator.cl).                                   **/
+/** ************************************************************************************************** **/
+int acc_decode_init( const int* grammar, int grammar_size, int initial_symbol, int number_of_words, int number_of_bits, int bits_per_gene, int bits_per_constant, const float* interval );
+
+/** ************************************************************************************************** **/
+/** ************************************** Function decode ******************************************* **/
+/** ************************************************************************************************** **/
+/** Decodes the 'nInd' genomes on the device, leaving the programs there for the next acc_interpret    **/
+/** (which is then called with a NULL 'program'); only their sizes and lengths come back.              **/
+/** ************************************************************************************************** **/
+void acc_decode( const GENOME_TYPE* const* genomes, int nInd, int* size, int* length );
+
+/** ************************************************************************************************** **/
+/** *********************************** Function evolve_init ***************************************** **/
+/** ************************************************************************************************** **/
+/** Enables the evolution on the device (after acc_decode_init): two populations, their fitnesses and  **/
+/** lengths, and one XorShift128+ state per pair of offspring ('seeds', two words each) are kept on    **/
+/** the device, which breeds them with the same operators of the host (see the kernel breed).          **/
+/** ************************************************************************************************** **/
+int acc_evolve_init( int number_of_bits, int bits_per_gene, int tournament_size, float crossover_rate, float mutation_rate, float twopoint_probability, float bitflip_probability, float aggressive_shrink_probability, const uint64_t* seeds );
+
+/** ************************************************************************************************** **/
+/** ************************************* Function generate ****************************************** **/
+/** ************************************************************************************************** **/
+/** Creates (randomly) the initial population on the device.                                           **/
+/** ************************************************************************************************** **/
+void acc_generate();
+
+/** ************************************************************************************************** **/
+/** *************************************** Function breed ******************************************* **/
+/** ************************************************************************************************** **/
+/** Breeds the next population on the device out of the current one, which then becomes the parents.  **/
+/** The 'nImmigrants' immigrants take the first places, followed by the 'elite' individual (if any).   **/
+/** ************************************************************************************************** **/
+void acc_breed( int nImmigrants, const GENOME_TYPE* const* immigrants, const GENOME_TYPE* elite, float elite_fitness, int elite_length );
+
+/** ************************************************************************************************** **/
+/** ************************************* Function evaluate ****************************************** **/
+/** ************************************************************************************************** **/
+/** Decodes and evaluates the current population on the device (but its neutral individuals), giving  **/
+/** back the indices of its 'best_size' best individuals.                                              **/
+/** ************************************************************************************************** **/
+void acc_evaluate( float alpha, int* index, int* best_size );
+
+/** ************************************************************************************************** **/
+/** *************************************** Function fetch ******************************************* **/
+/** ************************************************************************************************** **/
+/** Reads the fitness and length (and the genome, if 'genome' is not NULL) of the individual 'idx' of  **/
+/** the current population.                                                                            **/
+/** ************************************************************************************************** **/
+void acc_fetch( int idx, GENOME_TYPE* genome, float* fitness, int* length );
+
+/** ************************************************************************************************** **/
+/** ********************************** Function fetch_population ************************************* **/
+/** ************************************************************************************************** **/
+/** Reads the genomes and fitnesses of the whole current population (for the migration).               **/
+/** ************************************************************************************************** **/
+void acc_fetch_population( GENOME_TYPE* const* genomes, float* fitness );
+
+/** ************************************************************************************************** **/
+/** ************************************** Function staging ****************************************** **/
+/** ************************************************************************************************** **/
+/** Gives the host arrays into which the programs to be evaluated by acc_interpret are to be packed:   **/
+/** the mapped (pinned) staging buffers of the device, with room for at least 'total_size' words (the  **/
+/** former contents are lost when enlarged). On devices sharing the memory with the host they are read **/
+/** in place by the kernel, without any copy. The pointers may change after each acc_interpret.        **/
+/** ************************************************************************************************** **/
+void acc_staging( unsigned total_size, Instruction** program, int** offset, int** size );
+
+/** ************************************************************************************************** **/
+/** ************************************ Function batches_init *************************************** **/
+/** ************************************************************************************************** **/
+/** Sets the number of batches that can be in flight at once (see acc_submit).                         **/
+/** ************************************************************************************************** **/
+void acc_batches_init( int number_of_batches );
+
+/** ************************************************************************************************** **/
+/** ************************************** Function stack_depth ************************************** **/
+/** ************************************************************************************************** **/
+/** The maximum depth of the stack (see the ARITY of the symbols) of the programs given to the next    **/
+/** acc_interpret or acc_submit, 0 if unknown: the evaluation kernel with the smallest stack that fits **/
+/** them is then used. It holds for that call only (e.g., the programs decoded on the device are not   **/
+/** known), being reset afterwards.                                                                    **/
+/** ************************************************************************************************** **/
+void acc_stack_depth( int depth );
+
+/** ************************************************************************************************** **/
+/** *************************************** Function submit ****************************************** **/
+/** ************************************************************************************************** **/
+/** Starts the evaluation of the 'nInd' (packed) programs of the batch 'batch' and returns right away; **/
+/** the programs must be kept untouched until the batch is waited for (see acc_wait). Each batch has   **/
+/** its own device buffers, so that one batch can be sent while another one is evaluated.              **/
+/** ************************************************************************************************** **/
+void acc_submit( int batch, const Instruction* program, const int* offset, const int* size, int nInd );
+
+/** ************************************************************************************************** **/
+/** **************************************** Function wait ******************************************* **/
+/** ************************************************************************************************** **/
+/** Waits for the evaluation of the batch 'batch' and gives back the fitnesses of its programs and the **/
+/** indices (within the batch) of the 'best_size' best ones.                                           **/
+/** ************************************************************************************************** **/
+void acc_wait( int batch, float* vector, const int* size, float alpha, int* index, int* best_size );
 
 /** ************************************************************************************************** **/
 /** ************************************** Function interpret **************************************** **/
 /** ************************************************************************************************** **/
 /**                                                                                                    **/
 /** ************************************************************************************************** **/
-void acc_interpret( Symbol* phenotype, float* ephemeral, int* size, 
+void acc_interpret( Instruction* program, int* offset, int* size, 
 #ifdef PROFILING
 unsigned long sum_size_gen, 
 #endif
-float* vector, int nInd, void (*send)(Population*), int (*receive)(GENOME_TYPE**), Population* migrants, int* nImmigrants, int* index, int* best_size, int ppp_mode, int prediction_mode, float alpha );
+float* vector, int nInd, void (*send)(Population*), int (*receive)(Population*), Population* migrants, int* nImmigrants, int* index, int* best_size, int ppp_mode, int prediction_mode, float alpha );
 
 /** ************************************************************************************************** **/
 /** ************************************** Function print_time *************************************** **/
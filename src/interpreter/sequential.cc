@@ -19,7 +19,13 @@
 #include <cmath>    
 #include <string>   
 #include <limits>
+#include <cstring>
 #include <queue>
+#include <algorithm>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "sequential.h"
 #include "../util/Util.h"
 
@@ -27,7 +33,7 @@
 /** ***************************** TYPES ****************************** **/
 /** ****************************************************************** **/
 
-static struct t_data { unsigned size; float** inputs; int nlin; int ncol; double time_total_kernel1; double time_total_kernel2; double time_gen_kernel1; double time_gen_kernel2; double gpops_gen_kernel; } data;
+static struct t_data { unsigned size; const util::Dataset* dataset; util::Dataset* copy; const float* target; float** block_stacks; int num_threads; int nlin; int ncol; double time_total_kernel1; double time_total_kernel2; double time_gen_kernel1; double time_gen_kernel2; double gpops_gen_kernel; } data;
 
 float native_divide(float x, float y) {
    return x / y;
@@ -75,11 +81,101 @@ float native_log2(float x) {
 
 #include "functions.h"
 
+/* The interpreter runs each program over a block of SEQ_LANES rows (lanes) at
+ * once, so that the cost of dispatching each symbol is shared by all the rows
+ * of the block. Each stack slot holds the SEQ_LANES values of a block, one
+ * after another, and the body of each case of 'interpreter_core_block' is run
+ * for every lane, which the compiler can turn into SIMD instructions (one
+ * AVX-512, AVX or two SSE registers). With SEQ_LANES=1 this is just the plain
+ * scalar interpreter. */
+#ifndef SEQ_LANES
+#if defined(__AVX512F__)
+#define SEQ_LANES 16
+#else
+#define SEQ_LANES 8
+#endif
+#endif
+
+/* The blocks of the last rows are read up to the padding of the columns */
+#if DATASET_PADDING % SEQ_LANES != 0
+#error "SEQ_LANES must be a divisor of DATASET_PADDING"
+#endif
+
+/* View of the lane 'lane' of the block stack, so that the cases of the
+ * interpreter can be written as if they were operating on a scalar stack */
+struct BlockStack {
+   float* base; int lane;
+   float& operator[]( int k ) const { return base[k * SEQ_LANES + lane]; }
+};
+
+/* Each lane gets its own copy of 'stack_top' (the stack effect of a symbol is
+ * the same for all the lanes); 'break' inside a case just leaves the lane's
+ * body (the do-while). */
+#define SEQ_BLOCK_BEGIN { const int top = block_top; int new_top = top; \
+   for( int lane = 0; lane < SEQ_LANES; ++lane ) { int stack_top = top; const BlockStack stack = { block_stack, lane }; do {
+#define SEQ_BLOCK_END } while( 0 ); new_top = stack_top; } block_top = new_top; }
+
+/* Interprets the program (its 'size' instructions followed by its constant
+ * pool) over the block of rows starting at 'block' using the (thread's)
+ * 'block_stack'; returns the slot with the results, one per lane. */
+static const float* interpret_block( const Instruction* program, int size, int block, float* block_stack )
+{
+   int block_top = -1;
+   for( int i = size - 1; i >= 0; --i )
+   {
+      switch( OPCODE( program[i] ) )
+      {
+         #include <interpreter_core_block>
+         case T_ATTRIBUTE:
+         {
+            const float* column = data.dataset->Column( OPERAND( program[i] ) ) + block;
+            float* slot = block_stack + (++block_top) * SEQ_LANES;
+            for( int lane = 0; lane < SEQ_LANES; ++lane ) slot[lane] = column[lane];
+            break;
+         }
+#ifndef NOT_USING_T_CONST
+         case T_CONST:
+         {
+            float value; memcpy( &value, program + size + OPERAND( program[i] ), sizeof(float) );
+            float* slot = block_stack + (++block_top) * SEQ_LANES;
+            for( int lane = 0; lane < SEQ_LANES; ++lane ) slot[lane] = value;
+            break;
+         }
+#endif
+         default:
+         {
+            float* slot = block_stack + (++block_top) * SEQ_LANES;
+            for( int lane = 0; lane < SEQ_LANES; ++lane ) slot[lane] = NAN; // "Invalidates" the stack (solution) if a non-recognized symbol (terminal) is given
+            break;
+         }
+      }
+   }
+
+   return block_stack + block_top * SEQ_LANES;
+}
+
+/* Orders the individuals by decreasing program size */
+struct BySizeDescending {
+   BySizeDescending( const int* size ): size( size ) {}
+   bool operator()( int a, int b ) const { return size[a] > size[b]; }
+   const int* size;
+};
+
+/* Block stack of the calling thread */
+static inline float* thread_block_stack()
+{
+#ifdef _OPENMP
+   return data.block_stacks[omp_get_thread_num()];
+#else
+   return data.block_stacks[0];
+#endif
+}
+
 /** ****************************************************************** **/
 /** ************************* MAIN FUNCTION ************************** **/
 /** ****************************************************************** **/
 
-void seq_interpret_init( const unsigned size, float** input, int nlin, int ncol ) 
+void seq_interpret_init( const unsigned size, const util::Dataset& input ) 
 {
 #ifdef PROFILING
    data.time_total_kernel1  = 0.0;
@@ -87,19 +183,34 @@ void seq_interpret_init( const unsigned size, float** input, int nlin, int ncol
 #endif
 
    data.size = size;
-   data.nlin = nlin;
-   data.ncol = ncol;
+   data.nlin = input.nlin;
+   data.ncol = input.ncol;
 
-   data.inputs = new float*[nlin];
-   for( int i = 0; i < nlin; i++ )
-     data.inputs[i] = new float[ncol];
+   /* The block interpreter reads the (column-major) dataset in place, so that
+      a T_ATTRIBUTE loads a contiguous slice of a column; the padding rows are
+      computed but ignored. A row-major dataset has to be copied, though. */
+   data.copy = NULL;
+   if( input.layout != util::Dataset::COLUMN_MAJOR )
+   {
+      data.copy = new util::Dataset();
+      if( !input.CopyTo( *data.copy, util::Dataset::COLUMN_MAJOR ) )
+         fprintf(stderr, "Not enough memory for the dataset (%d x %d).\n", input.nlin, input.ncol);
+   }
+   data.dataset = data.copy ? data.copy : &input;
+   data.target = data.dataset->Column( data.ncol - 1 );
 
-   for( int i = 0; i < nlin; i++ )
+   /* One block stack per thread, each one with an extra slot below the bottom
+      of the stack (filled with NaN), which is the result of an empty program. */
+#ifdef _OPENMP
+   data.num_threads = omp_get_max_threads();
+#else
+   data.num_threads = 1;
+#endif
+   data.block_stacks = new float*[data.num_threads];
+   for( int t = 0; t < data.num_threads; ++t )
    {
-     for( int j = 0; j < ncol; j++ )
-     {
-       data.inputs[i][j] = input[i][j];
-     }
+      data.block_stacks[t] = new float[(size + 1) * SEQ_LANES] + SEQ_LANES;
+      for( int lane = 0; lane < SEQ_LANES; ++lane ) data.block_stacks[t][lane - SEQ_LANES] = NAN;
    }
 
 //   for( int i = 0; i < nlin; i++ )
@@ -114,7 +225,7 @@ void seq_interpret_init( const unsigned size, float** input, int nlin, int ncol
 //   }
 }
 
-void seq_interpret( Symbol* phenotype, float* ephemeral, int* size, 
+void seq_interpret( Instruction* program, int* offset, int* size, 
 #ifdef PROFILING
 unsigned long sum_size_gen, 
 #endif
@@ -126,65 +237,72 @@ float* vector, int nInd, int* index, int* best_size, int ppp_mode, int predictio
    // Include the cost matrix definition if given
    #include "costmatrix"
 
-   float stack[data.size]; 
-   float sum; 
-   int stack_top;
-
-   for( int ind = 0; ind < nInd; ++ind )
+   if( ppp_mode && prediction_mode )
    {
-      if( size[ind] == 0 && !prediction_mode )
+      /* Prediction: the blocks of rows are spread among the threads */
+      for( int ind = 0; ind < nInd; ++ind )
       {
-         vector[ind] = std::numeric_limits<float>::max();
-         continue;
+#pragma omp parallel for schedule(static)
+         for( int block = 0; block < data.nlin; block += SEQ_LANES )
+         {
+            const float* result = interpret_block( program + offset[ind], size[ind], block, thread_block_stack() );
+            const int rows = std::min( SEQ_LANES, data.nlin - block );
+            for( int lane = 0; lane < rows; ++lane ) vector[block + lane] = result[lane];
+         }
       }
+   }
+   else
+   {
+      /* The individuals are spread among the threads, the longest programs
+         first; since their sizes vary wildly, they are handed out dynamically
+         so that the threads end up with about the same amount of work. */
+      std::vector<int> order( nInd );
+      for( int ind = 0; ind < nInd; ++ind ) order[ind] = ind;
+      std::stable_sort( order.begin(), order.end(), BySizeDescending( size ) );
 
-      sum = 0.0;
-      for( int ponto = 0; ponto < data.nlin; ++ponto )
+#pragma omp parallel for schedule(dynamic)
+      for( int k = 0; k < nInd; ++k )
       {
-         stack_top = -1;
-         for( int i = size[ind] - 1; i >= 0; --i )
+         const int ind = order[k];
+         if( size[ind] == 0 && !prediction_mode )
          {
-            switch( phenotype[ind * data.size + i] )
-            {
-               #include <interpreter_core>
-               case T_ATTRIBUTE:
-                  stack[++stack_top] = data.inputs[ponto][(int)ephemeral[ind * data.size + i]];
-                  //if ( ponto == 1 ) {printf( "T_ATTRIBUTE: %d %f \n", stack_top, stack[stack_top]);}
-                  break;
-#ifndef NOT_USING_T_CONST
-               case T_CONST:
-                  stack[++stack_top] = ephemeral[ind * data.size + i];
-                  //if ( ponto == 1 ) {printf( "T_CONST: %d %f \n", stack_top, stack[stack_top]);}
-                  break;
-#endif
-               default:
-                  stack[++stack_top] = NAN; // "Invalidates" the stack (solution) if a non-recognized symbol (terminal) is given
-                  break;
-            }
-         }
-         if( ppp_mode && prediction_mode ) {
-            vector[ponto] = stack[stack_top];
+            vector[ind] = std::numeric_limits<float>::max();
+            continue;
          }
-         else {
-            float error = ERROR(stack[stack_top], data.inputs[ponto][data.ncol-1]);
 
-            // Avoid further calculations if the current one has overflown the float
-            // (i.e., it is inf or NaN).
-            if( std::isinf(error) || std::isnan(error) ) { sum = std::numeric_limits<float>::max(); break; }
+         float* block_stack = thread_block_stack();
+         float sum = 0.0; bool overflow = false;
+         for( int block = 0; block < data.nlin && !overflow; block += SEQ_LANES )
+         {
+            const float* result = interpret_block( program + offset[ind], size[ind], block, block_stack );
+
+            /* The errors are accumulated row by row in the original order, so
+               that the fitness is exactly the same as the one computed one row
+               at a time. */
+            const int rows = std::min( SEQ_LANES, data.nlin - block );
+            for( int lane = 0; lane < rows; ++lane )
+            {
+               const int ponto = block + lane;
+               float error = ERROR(result[lane], data.target[ponto]);
+
+               // Avoid further calculations if the current one has overflown the float
+               // (i.e., it is inf or NaN).
+               if( std::isinf(error) || std::isnan(error) ) { sum = std::numeric_limits<float>::max(); overflow = true; break; }
 
 #ifdef REDUCEMAX
-            sum = (error*data.nlin > sum) ? error*data.nlin : sum;
+               sum = (error*data.nlin > sum) ? error*data.nlin : sum;
 #else
-            sum += error;
+               sum += error;
 #endif
+            }
          }
-      }
-      if( !prediction_mode )
-      {
-         if( std::isnan( sum ) || std::isinf( sum ) ) {vector[ind] = std::numeric_limits<float>::max();}
-         else 
+         if( !prediction_mode )
          {
-            vector[ind] = sum/data.nlin + alpha * size[ind];
+            if( std::isnan( sum ) || std::isinf( sum ) ) {vector[ind] = std::numeric_limits<float>::max();}
+            else 
+            {
+               vector[ind] = sum/data.nlin + alpha * size[ind];
+            }
          }
       }
    }
@@ -210,9 +328,10 @@ float* vector, int nInd, int* index, int* best_size, int ppp_mode, int predictio
 
 void seq_interpret_destroy() 
 {
-   for( int i = 0; i < data.nlin; ++i )
-     delete [] data.inputs[i];
-   delete [] data.inputs;
+   delete data.copy;
+   for( int t = 0; t < data.num_threads; ++t )
+     delete [] (data.block_stacks[t] - SEQ_LANES);
+   delete [] data.block_stacks;
 }
 
 #ifdef PROFILING
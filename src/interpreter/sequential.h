@@ -18,6 +18,7 @@
 
 #include <definitions.h>
 #include <symbol>
+#include "../util/Dataset.h"
 
 /** Funcoes exportadas **/
 /** ************************************************************************************************** **/
@@ -25,14 +26,14 @@
 /** ************************************************************************************************** **/
 /**                                                                                                    **/
 /** ************************************************************************************************** **/
-void seq_interpret_init( const unsigned size, float** input, int nlin, int ncol );
+void seq_interpret_init( const unsigned size, const util::Dataset& input );
 
 /** ************************************************************************************************** **/
 /** ************************************** Function interpret **************************************** **/
 /** ************************************************************************************************** **/
 /**                                                                                                    **/
 /** ************************************************************************************************** **/
-void seq_interpret( Symbol* phenotype, float* ephemeral, int* size, 
+void seq_interpret( Instruction* program, int* offset, int* size, 
 #ifdef PROFILING
 unsigned long sum_size_gen, 
 #endif
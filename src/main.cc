@@ -16,12 +16,21 @@
 #include <stdlib.h>
 #include <stdio.h> 
 #include <cmath>    
-#include <fstream>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "server/server.h"
 #include "Poco/Exception.h"
 #include "util/CmdLineParser.h"
 #include "util/Exception.h"
 #include "util/Util.h"
+#include "util/Dataset.h"
 #include "ppi.h"
 #include "ppp.h"
 
@@ -29,105 +38,309 @@
 /** *********************** AUXILIARY FUNCTIONS ********************** **/
 /** ****************************************************************** **/
 
-int read( const std::string& dataset, float**& input, int &ncol, int& nlin )
+/* Parses the decimal number at the beginning of [p, end) (after any leading
+ * white space) into 'value', just like 'util::StringTo<float>' (an
+ * 'istringstream') would, i.e., the characters after the number are ignored,
+ * but without its overhead and regardless of the locale. Returns false if
+ * there is no valid number. */
+static bool parse_float( const char* p, const char* end, float& value )
 {
-   std::ifstream infile( dataset.c_str() );
+   static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10 };
 
-   if (!infile) {
-      fprintf(stderr, "Failed to open dataset file '%s' (use '-d dataset', where dataset is the path of the training CSV file)\n", dataset.c_str());
-      return 2;
-   }
+   while( p < end && isspace( (unsigned char) *p ) ) ++p;
+   const char* start = p;
 
-   std::string line; std::string token;
+   bool negative = false;
+   if( p < end && (*p == '+' || *p == '-') ) negative = *p++ == '-';
+
+   uint64_t mantissa = 0; int digits = 0; int exponent = 0; bool any = false;
+   for( ; p < end && isdigit( (unsigned char) *p ); ++p, any = true )
+   {
+      if( digits < 19 ) { mantissa = mantissa * 10 + (*p - '0'); if( mantissa ) ++digits; }
+      else ++exponent;
+   }
+   if( p < end && *p == '.' )
+      for( ++p; p < end && isdigit( (unsigned char) *p ); ++p, any = true )
+      {
+         if( digits < 19 ) { mantissa = mantissa * 10 + (*p - '0'); if( mantissa ) ++digits; --exponent; }
+      }
+   if( !any ) return false;
 
-   ncol = 0; nlin = 0; float tmp;
-   bool header = true;
-   while( std::getline(infile, line) )
+   if( p < end && (*p == 'e' || *p == 'E') )
    {
-      if( !line.empty() && line[0] != '#' ) 
-      { 
-         std::istringstream iss( line );
+      const char* q = p + 1;
+      bool negative_exponent = false;
+      if( q < end && (*q == '+' || *q == '-') ) negative_exponent = *q++ == '-';
+      if( q == end || !isdigit( (unsigned char) *q ) ) return false; // As 'istringstream', "1e" is not a number
 
-         if( header )
-         {
-            while( std::getline(iss, token, ',') ) { ncol++; }
-            if ( util::StringTo<float>(tmp, token) ) { header = false; }
-         }
+      int e = 0;
+      for( ; q < end && isdigit( (unsigned char) *q ); ++q ) if( e < 100000 ) e = e * 10 + (*q - '0');
+      exponent += negative_exponent ? -e : e;
+      p = q;
+   }
 
-         if( header ) { header = false; } 
-         else { nlin++; }
-      }
+   /* When both the mantissa and the power of ten are exactly representable
+      as floats, a single (double precision) operation correctly rounds the
+      result; otherwise, the standard (and slower) conversion is used. */
+   if( mantissa < (1 << 24) && exponent >= -10 && exponent <= 10 )
+   {
+      const double v = exponent < 0 ? mantissa / pow10[-exponent] : mantissa * pow10[exponent];
+      value = (float) (negative ? -v : v);
+   }
+   else
+   {
+      const std::string number( start, p );
+      value = strtof( number.c_str(), NULL );
    }
 
-   input = new float*[nlin];
-   for( int i = 0; i < nlin; i++ )
-     input[i] = new float[ncol];
+   return true;
+}
 
-   infile.clear();
-   infile.seekg(0);
+/* A piece of the CSV file (a sequence of whole lines), parsed by one thread */
+struct Chunk {
+   const char* begin; const char* end;
+   std::vector<float> values; // The rows (row-major)
+   int lines;                 // Number of lines (all of them, as for the error messages)
+   int error, error_line, error_column;
+};
 
-   int i = 0; int k = 0;
-   header = true;
-   while( std::getline(infile, line) ) 
-   {
-      if( !line.empty() && line[0] != '#' ) 
-      {
+/* Parses the lines of 'chunk', expected to have 'ncol' columns, stopping at
+ * the first invalid one (the error is recorded in the chunk). */
+static void parse_chunk( Chunk& chunk, int ncol )
+{
+   std::vector<float> row( ncol );
 
-         std::istringstream iss( line );
+   chunk.lines = 0; chunk.error = 0;
+   for( const char* line = chunk.begin; line < chunk.end; ++chunk.lines )
+   {
+      const char* eol = (const char*) memchr( line, '\n', chunk.end - line );
+      if( !eol ) eol = chunk.end;
 
+      if( eol > line && line[0] != '#' )
+      {
+         /* The columns are split as 'std::getline(...,',')' does, i.e., a
+            trailing comma does not make an extra (empty) column. */
          int j = 0;
-         while( std::getline(iss, token, ',') )
+         for( const char* token = line; token < eol; ++j )
          {
-            if( header )
-            {
-               if ( !util::StringTo<float>(tmp, token) ) { break; }
-               else { header = false; }
-            }
+            const char* comma = (const char*) memchr( token, ',', eol - token );
+            if( !comma ) comma = eol;
 
-            if ( !util::StringTo<float>(input[i][j], token) ) 
+            float value;
+            if( !parse_float( token, comma, value ) || std::isnan( value ) || std::isinf( value ) )
             {
-               if( header )
-                  header =  false;
-               else 
-               {
-                  fprintf(stderr, "Invalid input at line %d, column %d.\n", k+1, j+1);
-                  return 2;
-               }
+               chunk.error = 2; chunk.error_line = chunk.lines; chunk.error_column = j;
+               return;
             }
-            if( std::isnan( input[i][j]) || std::isinf(input[i][j]) )
-            {
-               fprintf(stderr, "Invalid input at line %d, column %d.\n", k+1, j+1);
-               return 2;
-            }
-            //std::cout << input[i][j] << " ";
-            j++;
+            if( j < ncol ) row[j] = value;
+
+            token = comma + 1;
          }
-         if( !header )
+
+         if( j != ncol )
          {
-            if( ncol != j )
-            {
-               fprintf(stderr,"Line '%d' has '%d' columns but the expected number is '%d'.\n", k+1, j, ncol);
-               return 1;
-            }
+            chunk.error = 1; chunk.error_line = chunk.lines; chunk.error_column = j;
+            return;
          }
-         if( header ) { header = false; }
-         else { i++; ncol = j; }//std::cout << std::endl; }
+
+         chunk.values.insert( chunk.values.end(), row.begin(), row.end() );
       }
-      k++;
+
+      line = eol + 1;
+   }
+}
+
+/* Reads the CSV file 'dataset' into 'input' (with the given 'layout'). The
+ * first line (not empty nor a comment) is a header if its first column is not
+ * a number; either way, it defines the number of columns of all the others.
+ *
+ * The file is mapped into memory and split into pieces of whole lines, which
+ * are parsed in parallel and then put together into 'input'. */
+int read( const std::string& dataset, util::Dataset& input, util::Dataset::Layout layout )
+{
+   int fd = open( dataset.c_str(), O_RDONLY );
+   struct stat st;
+
+   if (fd < 0 || fstat( fd, &st )) {
+      fprintf(stderr, "Failed to open dataset file '%s' (use '-d dataset', where dataset is the path of the training CSV file)\n", dataset.c_str());
+      if (fd >= 0) close( fd );
+      return 2;
+   }
+
+   const char* text = NULL;
+   if( st.st_size > 0 )
+   {
+      void* p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+      if( p == MAP_FAILED )
+      {
+         fprintf(stderr, "Failed to open dataset file '%s' (use '-d dataset', where dataset is the path of the training CSV file)\n", dataset.c_str());
+         close( fd );
+         return 2;
+      }
+      madvise( p, st.st_size, MADV_WILLNEED );
+      text = (const char*) p;
+   }
+   close( fd );
+   const char* end = text + st.st_size;
+
+   // Skips the empty lines and comments up to the first line (header or data)
+   const char* first = text; int k = 0;
+   while( first < end && (*first == '\n' || *first == '#') )
+   {
+      const char* eol = (const char*) memchr( first, '\n', end - first );
+      first = eol ? eol + 1 : end; k++;
+   }
+
+   int ncol = 0;
+   if( first < end )
+   {
+      const char* eol = (const char*) memchr( first, '\n', end - first );
+      if( !eol ) eol = end;
+
+      for( const char* c = first; c < eol; ++ncol )
+      {
+         c = (const char*) memchr( c, ',', eol - c );
+         c = c ? c + 1 : eol;
+      }
+
+      float tmp;
+      const char* comma = (const char*) memchr( first, ',', eol - first );
+      if( !parse_float( first, comma ? comma : eol, tmp ) ) { first = eol < end ? eol + 1 : end; k++; } // Header
    }
-   return 0;
 
-   //if( scanf(token.c_str(),"%f%*[^\n],",&input[i][j]) != 1 || isnan(input[i][j]) || isinf(input[i][j]) )
-   //if( scanf(token.c_str(),"%f,",&input[i][j]) != 1 || isnan(input[i][j]) || isinf(input[i][j]) )
+   /* Splits the remaining of the file into pieces of about the same size
+      (a few per thread, so that they can be balanced) ending at a newline */
+#ifdef _OPENMP
+   const int num_threads = omp_get_max_threads();
+#else
+   const int num_threads = 1;
+#endif
+   const size_t bytes = end - first;
+   const int num_chunks = (int) std::max( (size_t) 1, std::min( (size_t) 4 * num_threads, bytes / (1 << 16) ) );
+
+   std::vector<Chunk> chunks( num_chunks );
+   for( int c = 0; c < num_chunks; ++c )
+   {
+      const char* b = c == 0 ? first : chunks[c - 1].end;
+      const char* e = c == num_chunks - 1 ? end : std::max( b, first + bytes * (c + 1) / num_chunks );
+      if( e < end )
+      {
+         const char* eol = (const char*) memchr( e, '\n', end - e );
+         e = eol ? eol + 1 : end;
+      }
+      chunks[c].begin = b; chunks[c].end = e;
+   }
+
+#pragma omp parallel for schedule(dynamic)
+   for( int c = 0; c < num_chunks; ++c )
+      parse_chunk( chunks[c], ncol );
+
+   // Reports the first error (in the file order), if any
+   int nlin = 0;
+   std::vector<int> offset( num_chunks );
+   for( int c = 0; c < num_chunks; ++c )
+   {
+      if( chunks[c].error )
+      {
+         const int line = k + chunks[c].error_line;
+         if( chunks[c].error == 2 )
+            fprintf(stderr, "Invalid input at line %d, column %d.\n", line+1, chunks[c].error_column+1);
+         else
+            fprintf(stderr,"Line '%d' has '%d' columns but the expected number is '%d'.\n", line+1, chunks[c].error_column, ncol);
+         if( text ) munmap( (void*) text, st.st_size );
+         return chunks[c].error;
+      }
+      k += chunks[c].lines;
+      offset[c] = nlin; nlin += chunks[c].values.size() / std::max( ncol, 1 );
+   }
+
+   if( text ) munmap( (void*) text, st.st_size );
+
+   if( !input.Allocate( nlin, ncol, layout ) )
+   {
+      fprintf(stderr, "Not enough memory for the dataset (%d x %d).\n", nlin, ncol);
+      return 2;
+   }
+
+#pragma omp parallel for schedule(dynamic)
+   for( int c = 0; c < num_chunks; ++c )
+   {
+      const float* values = chunks[c].values.empty() ? NULL : &chunks[c].values[0];
+      const int rows = chunks[c].values.size() / std::max( ncol, 1 );
+      for( int i = 0; i < rows; ++i )
+         for( int j = 0; j < ncol; ++j )
+            input( offset[c] + i, j ) = values[i * ncol + j];
+
+      std::vector<float>().swap( chunks[c].values );
+   }
+
+   return 0;
 }
 
-void destroy( float** input, int nlin )
+/* Size and modification time (in nanoseconds) of 'filename' */
+bool file_status( const std::string& filename, uint64_t& size, int64_t& mtime )
 {
-   for( int i = 0; i < nlin; ++i )
-     delete [] input[i];
-   delete [] input;
+   struct stat st;
+   if( stat( filename.c_str(), &st ) ) return false;
+
+   size = st.st_size; mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+   return true;
 }
 
+/* Loads the dataset, either a CSV file or a binary one (see util::Dataset),
+ * into 'input' with the given 'layout'. A CSV file is cached, if 'cache' is
+ * set, as a binary file beside it ('dataset'.bin), which is used instead of
+ * parsing the CSV again as long as the size and modification time of the CSV
+ * file don't change. */
+int load( const std::string& dataset, util::Dataset& input, util::Dataset::Layout layout, bool cache )
+{
+   util::Dataset binary;
+
+   if( util::Dataset::IsBinary( dataset.c_str() ) )
+   {
+      if( binary.Load( dataset.c_str() ) )
+      {
+         fprintf(stderr, "Invalid binary dataset file '%s'.\n", dataset.c_str());
+         return 2;
+      }
+   }
+   else
+   {
+      const std::string cache_file = dataset + ".bin";
+      uint64_t size = 0, cached_size; int64_t mtime = 0, cached_mtime;
+
+      cache = cache && file_status( dataset, size, mtime );
+      if( !cache || binary.Load( cache_file.c_str(), &cached_size, &cached_mtime ) || cached_size != size || cached_mtime != mtime )
+      {
+         binary.Free();
+
+         int error = read( dataset, input, layout );
+         if ( error ) {return error;}
+
+         /* The cache is written into a temporary file that is then renamed, so
+            that concurrent processes (islands) never see a partial file. A
+            failure (e.g., a read-only directory) is not an error, though. */
+         if( cache )
+         {
+            const std::string tmp = cache_file + "." + util::ToString( getpid() );
+            if( input.Save( tmp.c_str(), size, mtime ) ) rename( tmp.c_str(), cache_file.c_str() );
+            else unlink( tmp.c_str() );
+         }
+
+         return 0;
+      }
+   }
+
+   // The binary dataset is used as is (mapped) only if it has the wanted layout
+   if( binary.layout == layout ) binary.Swap( input );
+   else if( !binary.CopyTo( input, layout ) )
+   {
+      fprintf(stderr, "Not enough memory for the dataset (%d x %d).\n", binary.nlin, binary.ncol);
+      return 2;
+   }
+
+   return 0;
+}
 
 int main(int argc, char** argv)
 {
@@ -140,21 +353,41 @@ int main(int argc, char** argv)
       Opts.Int.Add( "-port", "--number_of_port" );
       Opts.String.Add( "-d", "--dataset" );
       Opts.String.Add( "-sol", "--solution" );
+      Opts.Bool.Add( "-acc" );
+      Opts.Bool.Add( "-transpose", "--transpose" );
+      Opts.String.Add( "-convert" );
+      Opts.Bool.Add( "-ndc", "--no-dataset-cache" );
 
       Opts.Process();
 
       Common::SetupLogger( "information" );
 
-      int nlin; int ncol;
-      float** input;
-
+      /* The dataset is stored in the layout wanted by the interpreter, so that
+         it can be used as is (without copies): the non-transposed OpenCL
+         kernels read it row by row; everyone else, column by column. */
+      util::Dataset input;
+      util::Dataset::Layout layout = Opts.Bool.Get("-acc") && !Opts.Bool.Get("-transpose") ? util::Dataset::ROW_MAJOR : util::Dataset::COLUMN_MAJOR;
 
-      int error = read( Opts.String.Get("-d"), input, ncol, nlin );
+      int error = load( Opts.String.Get("-d"), input, layout, !Opts.Bool.Get("-ndc") && !Opts.String.Found("-convert") );
       if ( error ) {return error;}
 
+      if( Opts.String.Found("-convert") )
+      {
+         /* Just converts the dataset into the binary format (use '-transpose'
+            or '-acc' to choose its layout, as above) */
+         uint64_t size = 0; int64_t mtime = 0;
+         file_status( Opts.String.Get("-d"), size, mtime );
+         if( !input.Save( Opts.String.Get("-convert").c_str(), size, mtime ) )
+         {
+            fprintf(stderr, "Failed to write the binary dataset file '%s'.\n", Opts.String.Get("-convert").c_str());
+            return 2;
+         }
+         return 0;
+      }
+
       if( Opts.String.Found("-sol") )
       {
-         ppi::ppp_init( input, nlin, ncol, argc, argv );
+         ppi::ppp_init( input, argc, argv );
          ppi::ppp_interpret();
          ppi::ppp_print( stdout );
          ppi::ppp_destroy();
@@ -170,7 +403,7 @@ int main(int argc, char** argv)
          srv.start();
          //sleep(100);
 
-         ppi::ppi_init( input, nlin, ncol, argc, argv );
+         ppi::ppi_init( input, argc, argv );
          int generations = ppi::ppi_evolve();
 
          fprintf(stdout, "\n> Overall best:");
@@ -183,8 +416,6 @@ int main(int argc, char** argv)
 #endif
          ppi::ppi_destroy();
       }
-
-      destroy(input, nlin);
    }
    catch( const CmdLine::E_Exception& e ) {
       std::cerr << e;
@@ -34,6 +34,7 @@
 #include <string>   
 #include <sstream>
 #include <iostream> 
+#include <sys/mman.h>
 #include "common/common.h"
 #include "util/CmdLineParser.h"
 #include "interpreter/accelerator.h"
@@ -45,6 +46,7 @@
 #include "grammar"
 #include "util/Util.h"
 #include "util/Random.h"
+#include "util/FitnessCache.h"
 #include "Poco/Logger.h"
 #ifdef _OPENMP
 #include <omp.h>
@@ -76,7 +78,13 @@ struct Peer {
   float frequency;
 };
 
-namespace ppi { struct t_data { Symbol initial_symbol; Population best_individual; int best_size; unsigned max_size_phenotype; int nlin; Symbol* phenotype; float* ephemeral; int* size; unsigned long long sum_size; int verbose; int machine; int elitism; int population_size; int immigrants_size; int generations; int number_of_bits; int bits_per_gene; int bits_per_constant; int seed; int tournament_size; float mutation_rate; float crossover_rate; float interval[2]; int parallel_version; double time_total_evolve; double time_gen_evolve; double time_generate; double time_total_evaluate; double time_gen_evaluate; double gpops_gen_evaluate; double time_total_crossover; double time_gen_crossover; double time_total_mutation; double time_gen_mutation; double time_total_clone; double time_gen_clone; double time_total_tournament; double time_gen_tournament; double time_total_send; double time_total_receive; double time_gen_receive; double time_total_decode; double time_gen_decode; std::vector<Peer> peers; Pool* pool; unsigned long stagnation_tolerance; RNG ** RNGs; int argc; char ** argv;  } data; };
+/* A batch of individuals evaluated asynchronously on the device (see
+   ppi_submit_batch): the individuals [begin, end) of a population, whose
+   programs are packed into the batch's own buffers, which are read (by the
+   device) while the host goes on, e.g. decoding or breeding another batch. */
+struct t_batch { int begin; int end; int nEval; int* list; int* size; int* offset; Instruction* program; long capacity; float* fitness; };
+
+namespace ppi { struct t_data { Symbol initial_symbol; Population best_individual; int best_size; unsigned max_size_phenotype; int nlin; Instruction* program; float* constants; int* num_constants; int* size; int* offset; int* packed_source; Instruction* packed_program; long packed_capacity; bool staging; bool device_decode; bool device_evolution; bool pipelined; int chunks; t_batch* chunk; const GENOME_TYPE** evaluation_genome; int* evaluation_length; unsigned long long sum_size; int verbose; int machine; int elitism; int population_size; int immigrants_size; int generations; int number_of_bits; int number_of_words; int genome_stride; GENOME_TYPE* genome_arena; int* genome_refs; int* genome_free; int genome_free_top; int genome_slots; int* evaluation_list; float* evaluation_fitness; util::FitnessCache* fitness_cache; std::string fitness_cache_file; uint64_t fitness_cache_tag; uint64_t* evaluation_hash; bool* evaluation_hit; int* cached_list; int bits_per_gene; int bits_per_constant; int seed; int tournament_size; float mutation_rate; float crossover_rate; float interval[2]; int parallel_version; double time_total_evolve; double time_gen_evolve; double time_generate; double time_total_evaluate; double time_gen_evaluate; double gpops_gen_evaluate; double time_total_crossover; double time_gen_crossover; double time_total_mutation; double time_gen_mutation; double time_total_clone; double time_gen_clone; double time_total_tournament; double time_gen_tournament; double time_total_send; double time_total_receive; double time_gen_receive; double time_total_decode; double time_gen_decode; std::vector<Peer> peers; Pool* pool; unsigned long stagnation_tolerance; RNG ** RNGs; int argc; char ** argv;  } data; };
 
 namespace ppi {
 
@@ -102,6 +110,14 @@ inline int GetMaxNumThreads() {
 
 #define swap(i, j) {Population t = *i; *i = *j; *j = t;}
 
+#define xstr(a) xstr_(a)
+#define xstr_(a) #a
+
+/* Alignment (in bytes) of each genome within the population arena (one cache
+ * line) and of the arena itself (one page). */
+#define POPULATION_ALIGNMENT 64
+#define POPULATION_ARENA_ALIGNMENT 4096
+
 double random_number() { return GetRNG()->Real(); }
 //double random_number() { double value = GetRNG()->Real(); std::cerr << value << std::endl; return value; }
 
@@ -114,10 +130,9 @@ t_rule* decode_rule( const GENOME_TYPE* genome, int* const allele, Symbol cabeca
    // Número de regras encabeçada por "cabeça"
    unsigned num_regras = tamanhos[cabeca];
 
-   // Converte data.bits_per_gene bits em um valor integral
-   unsigned valor_bruto = 0;
-   for( int i = 0; i < data.bits_per_gene; ++i )
-      if( genome[(*allele)++] ) valor_bruto += (1 << i); // (1<<i) is a more efficient way of performing 2^i
+   // Converte data.bits_per_gene bits em um valor integral (o primeiro bit é o menos significativo)
+   unsigned valor_bruto = genome_extract( genome, *allele, data.bits_per_gene );
+   *allele += data.bits_per_gene;
 
    // Seleciona uma regra no intervalo [0, num_regras - 1]
    return gramatica[cabeca][valor_bruto % num_regras];
@@ -130,15 +145,14 @@ float decode_real( const GENOME_TYPE* genome, int* const allele )
 
    // Converte data.bits_per_constant bits em um valor real
    // NB: This works backwards in the sense that the most significant bit is the last bit (from left to right).
-   unsigned long valor_bruto = 0;
-   for( int i = 0; i < data.bits_per_constant; ++i )
-      if( genome[(*allele)++] ) valor_bruto += (1UL << i);
+   unsigned long valor_bruto = genome_extract( genome, *allele, data.bits_per_constant );
+   *allele += data.bits_per_constant;
 
    // Normalizar para o intervalo desejado: a + valor_bruto * (b - a)/(2^n - 1)
    return data.interval[0] + float(valor_bruto) * (data.interval[1] - data.interval[0]) / ((1UL << data.bits_per_constant) - 1.0);
 }
 
-int decode( const GENOME_TYPE* genome, int* const allele, Symbol* phenotype, float* ephemeral, int pos, Symbol initial_symbol )
+int decode( const GENOME_TYPE* genome, int* const allele, Instruction* program, float* constants, int* num_constants, int pos, Symbol initial_symbol )
 {
    t_rule* r = decode_rule( genome, allele, initial_symbol ); 
    if( !r || pos >= data.max_size_phenotype ) { return 0; } /* When setting max_size_phenotype (via -mps) to a value less than
@@ -150,7 +164,7 @@ int decode( const GENOME_TYPE* genome, int* const allele, Symbol* phenotype, flo
    for( int i = 0; i < r->quantity; ++i )
       if( r->symbols[i] >= TERMINAL_MIN )
       {
-         phenotype[pos] = r->symbols[i];
+         program[pos] = INSTRUCTION( r->symbols[i], 0 );
 
 #ifndef NOT_USING_T_CONST
          // Tratamento especial para constantes efêmeras
@@ -161,28 +175,70 @@ int decode( const GENOME_TYPE* genome, int* const allele, Symbol* phenotype, flo
               para extrair uma constante real. Extrai-se data.bits_per_constant bits a 
               partir da posição atual e os decodifica como um valor real.
             */
-            ephemeral[pos] = decode_real( genome, allele );
+            if( *num_constants > MAX_OPERAND ) { return 0; } // The constant pool is full
+
+            constants[*num_constants] = decode_real( genome, allele );
+            program[pos] = INSTRUCTION( T_CONST, *num_constants );
+            ++*num_constants;
          }
          else
 #endif
          {
             if( r->symbols[i] >= ATTRIBUTE_MIN )
             {
-               phenotype[pos] = T_ATTRIBUTE;
-               ephemeral[pos] = r->symbols[i] - ATTRIBUTE_MIN;
+               program[pos] = INSTRUCTION( T_ATTRIBUTE, r->symbols[i] - ATTRIBUTE_MIN );
             } 
          }
          ++pos;
       }
       else // It's a non-terminal, so calling recursively decode again...
       {
-         pos = decode( genome, allele, phenotype, ephemeral, pos, r->symbols[i] );
+         pos = decode( genome, allele, program, constants, num_constants, pos, r->symbols[i] );
          if( !pos ) return 0;
       }
 
    return pos;
 }
 
+/* Maximum depth of the stack when interpreting the (decoded) program, which
+   is done from its last instruction to the first one: each symbol pops its
+   ARITY values and pushes its result. */
+int stack_depth( const Instruction* program, int size )
+{
+   int depth = 0, max_depth = 0;
+   for( int i = size - 1; i >= 0; --i )
+   {
+      depth += 1 - ARITY( OPCODE( program[i] ) );
+      if( depth > max_depth ) max_depth = depth;
+   }
+   return max_depth;
+}
+
+/* Hash of a decoded program, used as the key of the fitness cache. The
+   operands are hashed by value (the attribute index, or the constant itself)
+   as floats, so that the keys do not depend on the encoding of the program
+   and the persistent caches remain valid. */
+uint64_t phenotype_hash( const Instruction* program, const float* constants, int size )
+{
+   uint64_t h = util::FitnessCache::Hash( 0, size );
+   for( int i = 0; i < size; ++i )
+   {
+      const Symbol symbol = OPCODE( program[i] );
+      h = util::FitnessCache::Hash( h, symbol );
+#ifndef NOT_USING_T_CONST
+      if( symbol == T_ATTRIBUTE || symbol == T_CONST )
+#else
+      if( symbol == T_ATTRIBUTE )
+#endif
+      {
+         const float value = symbol == T_ATTRIBUTE ? (float) OPERAND( program[i] ) : constants[OPERAND( program[i] )];
+         uint32_t bits; memcpy( &bits, &value, sizeof(float) );
+         h = util::FitnessCache::Hash( h, bits );
+      }
+   }
+   return h;
+}
+
 
 /** ****************************************************************** **/
 /** ************************* MAIN FUNCTIONS ************************* **/
@@ -190,7 +246,65 @@ int decode( const GENOME_TYPE* genome, int* const allele, Symbol* phenotype, flo
 
 #include <interpreter_core_print>
 
-void ppi_init( float** input, int nlin, int ncol, int argc, char** argv ) 
+/** ****************************************************************** **/
+/** ***************************** BATCHES **************************** **/
+/** ****************************************************************** **/
+
+void ppi_batch_create( t_batch* batch, int begin, int end )
+{
+   const int n = end - begin;
+
+   batch->begin = begin; batch->end = end; batch->nEval = 0;
+   batch->list = new int[n];
+   batch->size = new int[n];
+   batch->offset = new int[n + 1];
+   batch->fitness = new float[n];
+   batch->capacity = n * std::min( 64U, data.max_size_phenotype );
+   batch->program = new Instruction[batch->capacity];
+}
+
+void ppi_batch_destroy( t_batch* batch )
+{
+   delete[] batch->list; delete[] batch->size; delete[] batch->offset;
+   delete[] batch->fitness; delete[] batch->program;
+}
+
+/* Gives the autotuner (see acc_autotune) a population to be timed: the one
+   decoded from random genomes, like the first generation. Its genomes come
+   from an RNG of its own, so that the evolution is not affected. */
+void ppi_autotune()
+{
+   RNG rng; rng.Seed( data.seed );
+
+   std::vector<GENOME_TYPE> genome( data.number_of_words );
+   std::vector<Instruction> program;
+   std::vector<int> offset( data.population_size + 1, 0 ), size( data.population_size );
+   for( int i = 0; i < data.population_size; ++i )
+   {
+      for( int j = 0; j < data.number_of_words; j++ ) genome[j] = rng.Int();
+      genome[data.number_of_words - 1] &= genome_tail_mask( data.number_of_bits );
+
+      int allele = 0, num_constants = 0;
+      size[i] = decode( &genome[0], &allele, data.program, data.constants, &num_constants, 0, data.initial_symbol );
+      if( !size[i] ) { num_constants = 0; }
+
+      program.insert( program.end(), data.program, data.program + size[i] );
+      for( int c = 0; c < num_constants; ++c )
+      {
+         Instruction word; memcpy( &word, &data.constants[c], sizeof(float) );
+         program.push_back( word );
+      }
+      offset[i + 1] = program.size();
+   }
+   program.push_back( 0 ); // Never empty
+
+   if( acc_autotune( &program[0], &offset[0], &size[0], data.population_size ) )
+   {
+      fprintf(stderr,"Error in the autotuning.\n");
+   }
+}
+
+void ppi_init( const util::Dataset& input, int argc, char** argv ) 
 {
    data.argc = argc; data.argv = argv;
    CmdLine::Parser Opts( argc, argv );
@@ -201,6 +315,27 @@ void ppi_init( float** input, int nlin, int ncol, int argc, char** argv )
 
    Opts.Bool.Add( "-acc" );
 
+   /* Decode the genomes on the device (with -acc), which then receives just
+      the genomes instead of the programs; disables the fitness cache, whose
+      keys are computed from the decoded programs */
+   Opts.Bool.Add( "-dd", "--device-decode" );
+
+   /* Evolve the populations entirely on the device (with -acc; implies -dd):
+      breeding, decoding and evaluation are all done there, and the host only
+      gets the best individuals and, if there are peers, the migrants */
+   Opts.Bool.Add( "-de", "--device-evolution" );
+
+   /* Pipelined (asynchronous steady-state) evolution (with -acc, but without
+      -dd/-de): each half of the population is bred and decoded while the
+      device evaluates the other half; disables the fitness cache */
+   Opts.Bool.Add( "-pl", "--pipelined" );
+
+   /* Number of chunks the population is evaluated in (with -acc, but without
+      -dd/-de/-pl): each chunk is decoded while the previous ones are being
+      sent and evaluated; disables the fitness cache [default = 1, i.e., the
+      whole population at once] */
+   Opts.Int.Add( "-ec", "--evaluation-chunks", 1, 1 );
+
    Opts.Int.Add( "-g", "--generations", 1000, 0, std::numeric_limits<int>::max() );
 
    Opts.Int.Add( "-s", "--seed", 0, 0, std::numeric_limits<long>::max() );
@@ -239,6 +374,15 @@ void ppi_init( float** input, int nlin, int ncol, int argc, char** argv )
 
    Opts.Int.Add( "-t", "--threads", -1, 0);
 
+   /* Maximum number of entries of the fitness cache, which maps (a hash of)
+      the phenotypes already evaluated into their fitness [0 = disabled] */
+   Opts.Int.Add( "-fc", "--fitness-cache", 65536, 0 );
+
+   /* If given, the fitness cache is loaded from this file at the beginning
+      (provided that it was built on the very same dataset and fitness
+      function) and saved into it at the end */
+   Opts.String.Add( "-fcf", "--fitness-cache-file" );
+
    // processing the command-line
    Opts.Process();
 
@@ -260,6 +404,10 @@ void ppi_init( float** input, int nlin, int ncol, int argc, char** argv )
    data.elitism = Opts.Bool.Get("-e");
 
    data.number_of_bits = Opts.Int.Get("-nb");
+   data.number_of_words = genome_words( data.number_of_bits );
+   /* Each genome in the population arena starts at a cache line boundary, so
+      that no two threads write to the same cache line while breeding. */
+   data.genome_stride = (data.number_of_words * sizeof(GENOME_TYPE) + POPULATION_ALIGNMENT - 1) / POPULATION_ALIGNMENT * POPULATION_ALIGNMENT / sizeof(GENOME_TYPE);
 
    // Parse bits_per_gene, but also increase it automatically if the given value (-bg) cannot hold the largest number of symbols of all rules
    data.bits_per_gene = Opts.Int.Get("-bg");
@@ -305,17 +453,78 @@ void ppi_init( float** input, int nlin, int ncol, int argc, char** argv )
    data.best_size = 1;
    data.best_individual.genome = NULL;
    data.best_individual.fitness = NULL;
+   data.best_individual.slot = NULL;
+   data.best_individual.length = NULL;
+   data.best_individual.neutral = NULL;
 
    data.max_size_phenotype = std::min( MAX_QUANT_SIMBOLOS_POR_REGRA * data.number_of_bits/data.bits_per_gene, Opts.Int.Get<int>("-mps") );
 
 
-   data.nlin = nlin;
+   data.nlin = input.nlin;
 
-   data.phenotype = new Symbol[data.population_size * data.max_size_phenotype];
-   data.ephemeral = new float[data.population_size * data.max_size_phenotype];
+   /* The programs are decoded into slots of max_size_phenotype instructions
+      (and as many constants; only the used part of each one is ever touched),
+      and then packed back to back, in the order they are evaluated, into the
+      packed buffer: the instructions of the program 'k' are at [offset[k],
+      offset[k] + size[k]), followed by its constant pool (up to offset[k+1]).
+      The packed buffer grows on demand. */
+   data.program = new Instruction[data.population_size * data.max_size_phenotype];
+   data.constants = new float[data.population_size * data.max_size_phenotype];
+   data.num_constants = new int[data.population_size];
    data.size = new int[data.population_size];
+   data.offset = new int[data.population_size + 1];
+   data.packed_source = new int[data.population_size];
+   data.packed_capacity = data.population_size * std::min( 64U, data.max_size_phenotype );
+   data.packed_program = new Instruction[data.packed_capacity];
    data.sum_size = 0;
 
+   data.evaluation_list = new int[data.population_size];
+   data.evaluation_fitness = new float[data.population_size];
+
+   data.device_evolution = Opts.Bool.Get("-acc") && Opts.Bool.Get("-de");
+   data.device_decode = Opts.Bool.Get("-acc") && (Opts.Bool.Get("-dd") || data.device_evolution);
+   data.pipelined = Opts.Bool.Get("-acc") && Opts.Bool.Get("-pl") && !data.device_decode;
+   data.chunks = Opts.Bool.Get("-acc") && !data.device_decode && !data.pipelined ? std::min( Opts.Int.Get<int>("-ec"), data.population_size ) : 1;
+   data.chunk = NULL;
+   data.staging = false;
+   data.evaluation_genome = new const GENOME_TYPE*[data.population_size];
+   data.evaluation_length = new int[data.population_size];
+
+   data.fitness_cache = NULL;
+   if( Opts.Int.Get("-fc") > 0 && !data.device_decode && !data.pipelined && data.chunks == 1 )
+   {
+      data.fitness_cache = new util::FitnessCache( Opts.Int.Get("-fc") );
+      data.evaluation_hash = new uint64_t[data.population_size];
+      data.evaluation_hit = new bool[data.population_size];
+      data.cached_list = new int[data.population_size];
+
+      if( Opts.String.Found("-fcf") )
+      {
+         data.fitness_cache_file = Opts.String.Get("-fcf");
+
+         /* The persisted fitnesses are only valid for the same problem (label),
+            fitness function and dataset, which are all hashed into the tag. */
+         uint64_t tag = 0;
+         for( const char* c = xstr(LABEL) ERROR_STRING; *c; ++c ) tag = util::FitnessCache::Hash( tag, *c );
+#ifdef REDUCEMAX
+         tag = util::FitnessCache::Hash( tag, 1 );
+#endif
+         tag = util::FitnessCache::Hash( tag, input.nlin );
+         tag = util::FitnessCache::Hash( tag, input.ncol );
+         for( int i = 0; i < input.nlin; ++i )
+            for( int j = 0; j < input.ncol; ++j )
+            {
+               const float value = input( i, j );
+               uint32_t bits; memcpy( &bits, &value, sizeof(float) );
+               tag = util::FitnessCache::Hash( tag, bits );
+            }
+         data.fitness_cache_tag = tag;
+
+         long loaded = data.fitness_cache->Load( data.fitness_cache_file.c_str(), tag );
+         if( data.verbose && loaded >= 0 ) std::cerr << "Fitness cache: " << loaded << " entries loaded from '" << data.fitness_cache_file << "'\n";
+      }
+   }
+
    std::string str = Opts.String.Get("-peers");
    //std::cout << str << std::endl;
 
@@ -360,14 +569,66 @@ void ppi_init( float** input, int nlin, int ncol, int argc, char** argv )
    data.parallel_version = Opts.Bool.Get("-acc");
    if( data.parallel_version )
    {
-      if( acc_interpret_init( argc, argv, data.max_size_phenotype, MAX_QUANT_SIMBOLOS_POR_REGRA, data.population_size, input, nlin, ncol, 0, 0 ) )
+      if( acc_interpret_init( argc, argv, data.max_size_phenotype, MAX_QUANT_SIMBOLOS_POR_REGRA, data.population_size, input, 0, 0 ) )
       {
          fprintf(stderr,"Error in initialization phase.\n");
       }
+
+      if( acc_autotuning() ) ppi_autotune();
+
+      /* The programs are packed straight into the (pinned) staging memory of
+         the device, which is transfer-ready or even read in place; not when
+         decoding on the device, nor in the pipelined and chunked modes, which
+         pack into the arrays of their own batches */
+      data.staging = !data.device_decode && !data.pipelined && data.chunks <= 1;
+      if( data.staging )
+      {
+         delete[] data.size; delete[] data.offset; delete[] data.packed_program;
+         acc_staging( data.packed_capacity, &data.packed_program, &data.offset, &data.size );
+      }
+
+      if( data.pipelined )
+      {
+         acc_batches_init( 2 );
+      }
+      else if( data.chunks > 1 )
+      {
+         acc_batches_init( data.chunks );
+         data.chunk = new t_batch[data.chunks];
+         for( int c = 0; c < data.chunks; ++c )
+         {
+            ppi_batch_create( &data.chunk[c], (long) c * data.population_size / data.chunks, (long) (c + 1) * data.population_size / data.chunks );
+         }
+      }
+
+      if( data.device_decode )
+      {
+         /* Flat form of the grammar for the device: the index of the first rule
+            and the number of rules of each non-terminal, followed by the rules
+            themselves (number of symbols plus MAX_QUANT_SIMBOLOS_POR_REGRA
+            symbols each). */
+         const int num_nonterminals = sizeof(tamanhos) / sizeof(tamanhos[0]);
+         std::vector<int> grammar( 2 * num_nonterminals );
+         for( int nt = 0; nt < num_nonterminals; ++nt )
+         {
+            grammar[2 * nt] = grammar.size(); grammar[2 * nt + 1] = tamanhos[nt];
+            for( unsigned r = 0; r < tamanhos[nt]; ++r )
+            {
+               grammar.push_back( gramatica[nt][r]->quantity );
+               for( unsigned i = 0; i < MAX_QUANT_SIMBOLOS_POR_REGRA; ++i )
+                  grammar.push_back( i < gramatica[nt][r]->quantity ? gramatica[nt][r]->symbols[i] : 0 );
+            }
+         }
+
+         if( acc_decode_init( &grammar[0], grammar.size(), data.initial_symbol, data.number_of_words, data.number_of_bits, data.bits_per_gene, data.bits_per_constant, data.interval ) )
+         {
+            fprintf(stderr,"Error in initialization phase.\n");
+         }
+      }
    }
    else
    {
-      seq_interpret_init( data.max_size_phenotype, input, nlin, ncol );
+      seq_interpret_init( data.max_size_phenotype, input );
    }
 
    data.stagnation_tolerance = Opts.Int.Get( "-st" );
@@ -399,18 +660,178 @@ void ppi_init( float** input, int nlin, int ncol, int argc, char** argv )
 
 }
 
+/** ****************************************************************** **/
+/** *************************** GENOME POOL ************************** **/
+/** ****************************************************************** **/
+
+/* All the genomes (of both populations and of the best individuals) live in a
+   single slab of 'genome_slots' slots, one after another at a fixed stride
+   (data.genome_stride words). Compared to one allocation per individual, this
+   keeps the genomes contiguous, allows for streaming copies and requires much
+   fewer TLB entries.
+
+   The slots are reference-counted so that a clone just shares the slot of the
+   original (copy-on-write); the slot is only materialized (copied) when the
+   clone is about to be written, e.g., by a mutation. Since every live slot is
+   referenced by at least one individual, 2 * population_size + best_size
+   slots are always enough.
+
+   Concurrency: acquiring (pop), sharing and unsharing are lock-free (OpenMP
+   atomics) and can be done from the breeding threads, but a slot is only
+   pushed back into the free stack when its last reference goes away, which
+   never happens during breeding (the parents in 'antecedentes' hold their
+   references until the next generation); thus pushes and pops never race. */
+void ppi_genome_pool_create( int slots )
+{
+   const size_t bytes = (size_t) slots * data.genome_stride * sizeof(GENOME_TYPE);
+   void* arena;
+   if( posix_memalign( &arena, POPULATION_ARENA_ALIGNMENT, bytes ) ) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+   madvise( arena, bytes, MADV_HUGEPAGE ); // Just a hint; it is fine if it fails
+#endif
+
+   data.genome_arena = (GENOME_TYPE*) arena;
+   data.genome_refs  = new int[slots];
+   data.genome_free  = new int[slots];
+   data.genome_slots = slots;
+
+   /* The free stack is popped from its top, so it is filled in the reverse
+      order in order to hand out the slots sequentially (in the order the
+      populations are created). */
+   data.genome_free_top = slots;
+   for( int s = 0; s < slots; ++s ) { data.genome_free[s] = slots - 1 - s; data.genome_refs[s] = 0; }
+
+   /* The arena is first touched (zeroed) in the same static order as the
+      breeding loop walks the population (see ppi_evolve), so that on NUMA
+      systems the initial slots are local to the thread that writes into
+      them. Once slots start to be recycled and shared this is best-effort. */
+#pragma omp parallel for schedule(static)
+   for( int s = 0; s < slots; ++s )
+   {
+      memset( data.genome_arena + (size_t) s * data.genome_stride, 0, data.genome_stride * sizeof(GENOME_TYPE) );
+   }
+}
+
+void ppi_genome_pool_destroy()
+{
+   free( data.genome_arena );
+   delete[] data.genome_refs;
+   delete[] data.genome_free;
+}
+
+/* Takes a free slot (with a single reference) */
+static int genome_acquire()
+{
+   int top;
+#pragma omp atomic capture
+   top = --data.genome_free_top;
+
+   assert( top >= 0 );
+
+   const int s = data.genome_free[top];
+   data.genome_refs[s] = 1;
+   return s;
+}
+
+/* Drops one reference to the slot 's'; the last one gives it back */
+static void genome_release( int s )
+{
+   if( s < 0 ) return;
+
+   int refs;
+#pragma omp atomic capture
+   refs = --data.genome_refs[s];
+
+   if( refs == 0 )
+   {
+      int top;
+#pragma omp atomic capture
+      top = data.genome_free_top++;
+
+      data.genome_free[top] = s;
+   }
+}
+
+/* Binds the individual 'idx' to the slot 's' (the reference is not counted here) */
+static inline void genome_bind( Population* population, int idx, int s )
+{
+   population->slot[idx] = s;
+   population->genome[idx] = data.genome_arena + (size_t) s * data.genome_stride;
+}
+
+/* Gives the individual 'idx' a fresh (exclusive) slot, whose content is undefined */
+static void genome_renew( Population* population, int idx )
+{
+   genome_release( population->slot[idx] );
+   genome_bind( population, idx, genome_acquire() );
+}
+
+/* Makes sure the individual 'idx' is the only owner of its genome, copying it
+   into a fresh slot if it is currently shared (copy-on-write). */
+static void genome_unshare( Population* population, int idx )
+{
+   const int s = population->slot[idx];
+
+   int refs;
+#pragma omp atomic read
+   refs = data.genome_refs[s];
+
+   if( refs == 1 ) return;
+
+   const int t = genome_acquire();
+   memcpy( data.genome_arena + (size_t) t * data.genome_stride, population->genome[idx], data.number_of_words * sizeof(GENOME_TYPE) );
+   genome_bind( population, idx, t );
+   genome_release( s );
+}
+
+void ppi_population_create( Population* population, int size )
+{
+   population->genome = new GENOME_TYPE*[size];
+   population->fitness = new float[size];
+   population->slot = new int[size];
+   population->length = new int[size];
+   population->neutral = new bool[size];
+
+   for( int i = 0; i < size; ++i )
+   {
+      genome_bind( population, i, genome_acquire() );
+      population->fitness[i] = std::numeric_limits<float>::max();
+      population->length[i] = 0;
+      population->neutral[i] = false;
+   }
+}
+
+void ppi_population_destroy( Population* population, int size )
+{
+   for( int i = 0; i < size; ++i ) genome_release( population->slot[i] );
+
+   delete[] population->genome;
+   delete[] population->fitness;
+   delete[] population->slot;
+   delete[] population->length;
+   delete[] population->neutral;
+}
+
 void ppi_clone( Population* original, int idx_original, Population* copy, int idx_copy )
 {
 #ifdef PROFILING
    util::Timer t_clone;
 #endif
 
-   const GENOME_TYPE* const org = original->genome[idx_original];
-   GENOME_TYPE* cpy = copy->genome[idx_copy];
+   /* No bit is copied: the copy just shares the original's slot */
+   const int s = original->slot[idx_original];
+   if( copy->slot[idx_copy] != s )
+   {
+#pragma omp atomic
+      ++data.genome_refs[s];
 
-   for( int i = 0; i < data.number_of_bits; ++i ) cpy[i] = org[i];
+      genome_release( copy->slot[idx_copy] );
+      genome_bind( copy, idx_copy, s );
+   }
 
    copy->fitness[idx_copy] = original->fitness[idx_original];
+   copy->length[idx_copy] = original->length[idx_original];
+   copy->neutral[idx_copy] = true;
 
 #ifdef PROFILING
    double elapsed = t_clone.elapsed();
@@ -479,7 +900,7 @@ void ppi_send_individual( Population* population )
          std::stringstream results;
          results <<  population->fitness[idx] << " ";
          for( int j = 0; j < data.number_of_bits; j++ )
-            results <<  static_cast<int>(population->genome[idx][j]); /* NB: A cast to 'int' is necessary here otherwise it will send characters instead of digits when GENOME_TYPE == char */
+            results << (genome_get( population->genome[idx], j ) ? '1' : '0');
 
          delete data.pool->clients[i]; delete data.pool->ss[i];
 
@@ -508,7 +929,7 @@ void ppi_send_individual( Population* population )
 #endif
 }
 
-int ppi_receive_individual( GENOME_TYPE** immigrants )
+int ppi_receive_individual( Population* immigrants )
 {
 #ifdef PROFILING
    util::Timer t_receive;
@@ -545,11 +966,15 @@ int ppi_receive_individual( GENOME_TYPE** immigrants )
        * island is smaller than the '-nb' of the current island. The line below
        * handles this case (it also takes into account the offset). */
       int chars_to_convert = std::min((int) data.number_of_bits, (int) Server::m_immigrants[slot].size() - offset - 1);
+
+      // The immigrant will be written in place, so its genome can't be shared
+      genome_unshare( immigrants, nImmigrants );
+      immigrants->neutral[nImmigrants] = false;
       //std::cerr << "\n[" << offset << ", " << Server::m_immigrants[slot].size() << ", " << chars_to_convert << ", " << data.number_of_bits << "]\n";
       for( int i = 0; i < chars_to_convert && tmp[i] != '\0'; i++ )
       {
          assert(tmp[i]-'0'==1 || tmp[i]-'0'==0); // In debug mode, assert that each value is either '0' or '1'
-         immigrants[nImmigrants][i] = static_cast<bool>(tmp[i] - '0'); /* Ensures that the allele will be binary (0 or 1) regardless of the received value--this ensures it would work even if a communication error occurs (or a malicious message is sent). */
+         genome_set( immigrants->genome[nImmigrants], i, tmp[i] != '0' ); /* Ensures that the allele will be binary (0 or 1) regardless of the received value--this ensures it would work even if a communication error occurs (or a malicious message is sent). */
       }
       nImmigrants++;
 
@@ -569,47 +994,274 @@ int ppi_receive_individual( GENOME_TYPE** immigrants )
    return nImmigrants;
 }
 
-unsigned long ppi_evaluate( Population* descendentes, Population* antecedentes, int* nImmigrants )
+/* Decodes the non-neutral individuals of the 'batch' and sends them to the device */
+void ppi_submit_batch( Population* descendentes, t_batch* batch, int b )
 {
 #ifdef PROFILING
    unsigned long sum_size_gen = 0;
-   util::Timer t_evaluate, t_decode;
-   //int max_size = 0;
+   util::Timer t_decode;
 #endif
 
+   batch->nEval = 0;
+   for( int i = batch->begin; i < batch->end; i++ )
+   {
+      if( !descendentes->neutral[i] ) { batch->list[batch->nEval++] = i; }
+   }
+
 #ifdef PROFILING
 #pragma omp parallel for reduction(+:sum_size_gen)
 #else
 #pragma omp parallel for
 #endif
-   for( int i = 0; i < data.population_size; i++ )
+   for( int k = 0; k < batch->nEval; k++ )
    {
-      int allele = 0;
-      data.size[i] = decode( descendentes->genome[i], &allele, data.phenotype + (i * data.max_size_phenotype), data.ephemeral + (i * data.max_size_phenotype), 0, data.initial_symbol );
+      const int i = batch->list[k];
+
+      int allele = 0; data.num_constants[k] = 0;
+      batch->size[k] = decode( descendentes->genome[i], &allele, data.program + (k * data.max_size_phenotype), data.constants + (k * data.max_size_phenotype), &data.num_constants[k], 0, data.initial_symbol );
+      if( !batch->size[k] ) { data.num_constants[k] = 0; }
+      descendentes->length[i] = allele; // Alleles beyond this point are introns
 #ifdef PROFILING
-      sum_size_gen += data.size[i];
-      //if( max_size < data.size[i] ) max_size = data.size[i];
+      sum_size_gen += batch->size[k];
 #endif
    }
+
+   long total_size = 0;
+   for( int k = 0; k < batch->nEval; k++ )
+   {
+      batch->offset[k] = total_size;
+      total_size += batch->size[k] + data.num_constants[k];
+   }
+   batch->offset[batch->nEval] = total_size;
+
+   if( total_size > batch->capacity )
+   {
+      batch->capacity = std::max( total_size, 2 * batch->capacity );
+      delete[] batch->program; batch->program = new Instruction[batch->capacity];
+   }
+
+   int depth = 0; // The largest stack needed by the batch (see acc_stack_depth)
+#pragma omp parallel for reduction(max:depth)
+   for( int k = 0; k < batch->nEval; k++ )
+   {
+      memcpy( batch->program + batch->offset[k], data.program + (k * data.max_size_phenotype), batch->size[k] * sizeof(Instruction) );
+      memcpy( batch->program + batch->offset[k] + batch->size[k], data.constants + (k * data.max_size_phenotype), data.num_constants[k] * sizeof(float) );
+      depth = std::max( depth, stack_depth( batch->program + batch->offset[k], batch->size[k] ) );
+   }
+
 #ifdef PROFILING
-   data.time_gen_decode     = t_decode.elapsed();
+   data.sum_size           += sum_size_gen;
+   data.time_gen_decode    += t_decode.elapsed();
    data.time_total_decode  += t_decode.elapsed();
 #endif
 
+   acc_stack_depth( depth );
+   acc_submit( b, batch->program, batch->offset, batch->size, batch->nEval );
+}
+
+/* Evaluation of the population in chunks (see -ec): the chunks are decoded
+   one after another, each one being sent to the device as soon as it is
+   ready, so that decoding, transfers and evaluation overlap; the best ones
+   of each chunk are then merged. Otherwise the same as ppi_evaluate. */
+unsigned long ppi_evaluate_chunked( Population* descendentes, Population* antecedentes, int* nImmigrants )
+{
+#ifdef PROFILING
+   util::Timer t_evaluate;
+   data.time_gen_decode = 0.0;
+   const unsigned long long sum_size = data.sum_size;
+#endif
+
+   for( int c = 0; c < data.chunks; ++c ) ppi_submit_batch( descendentes, &data.chunk[c], c );
+
+   // The islands exchange individuals while the device is busy
+   ppi_send_individual( antecedentes );
+   *nImmigrants = ppi_receive_individual( antecedentes );
+
+   std::vector<int> candidates;
+   for( int c = 0; c < data.chunks; ++c )
+   {
+      t_batch* chunk = &data.chunk[c];
+
+      int index[data.best_size];
+      int nBest = std::min( data.best_size, chunk->nEval );
+      acc_wait( c, chunk->fitness, chunk->size, ALPHA, index, &nBest );
+
+      for( int k = 0; k < chunk->nEval; k++ ) { descendentes->fitness[chunk->list[k]] = chunk->fitness[k]; }
+      for( int i = 0; i < nBest; i++ ) { candidates.push_back( chunk->list[index[i]] ); }
+   }
+
+   // Final reduction of the best ones of each chunk
+   int index[data.best_size];
+   const int nBest = std::min( data.best_size, (int) candidates.size() );
+   if( nBest > 0 )
+   {
+      std::vector<float> errors( candidates.size() );
+      for( unsigned c = 0; c < candidates.size(); c++ ) { errors[c] = descendentes->fitness[candidates[c]]; }
+      util::PickNBest( nBest, index, candidates.size(), &errors[0], &candidates[0] );
+   }
+
+   for( int i = 0; i < data.best_size; i++ )
+   {
+      if( i < nBest && descendentes->fitness[index[i]] < data.best_individual.fitness[i] )
+      {
+         Server::stagnation = 0;
+         ppi_clone( descendentes, index[i], &data.best_individual, i );
+      }
+      else
+      {
+         ++Server::stagnation;
+      }
+   }
+
+#ifdef PROFILING
+   data.time_gen_evaluate     = t_evaluate.elapsed();
+   data.time_total_evaluate  += t_evaluate.elapsed();
+   data.gpops_gen_evaluate    = ((data.sum_size - sum_size) * data.nlin) / t_evaluate.elapsed();
+#endif
+
+   return Server::stagnation;
+}
+
+unsigned long ppi_evaluate( Population* descendentes, Population* antecedentes, int* nImmigrants )
+{
+   if( data.chunks > 1 ) return ppi_evaluate_chunked( descendentes, antecedentes, nImmigrants );
+
+#ifdef PROFILING
+   unsigned long sum_size_gen = 0;
+   util::Timer t_evaluate, t_decode;
+   //int max_size = 0;
+#endif
+
+   /* Only the individuals whose coding alleles have changed are decoded and
+      evaluated; the neutral ones have already inherited their parent's
+      fitness (see ppi_crossover and ppi_mutation). The k-th individual to be
+      evaluated is decoded into the slot 'k' of the program buffers. */
+   int nEval = 0;
+   for( int i = 0; i < data.population_size; i++ )
+   {
+      if( !descendentes->neutral[i] ) { data.evaluation_list[nEval++] = i; }
+   }
+
+   int nCached = 0;
+   int depth = 0; // The largest stack needed by the programs (see acc_stack_depth)
+   if( data.device_decode )
+   {
+      /* The genomes are decoded on the device, right into the buffers of the
+         programs to be evaluated; only their sizes and lengths come back. */
+      for( int k = 0; k < nEval; k++ ) data.evaluation_genome[k] = descendentes->genome[data.evaluation_list[k]];
+
+      acc_decode( data.evaluation_genome, nEval, data.size, data.evaluation_length );
+
+      for( int k = 0; k < nEval; k++ )
+      {
+         descendentes->length[data.evaluation_list[k]] = data.evaluation_length[k]; // Alleles beyond this point are introns
+#ifdef PROFILING
+         sum_size_gen += data.size[k];
+#endif
+      }
+#ifdef PROFILING
+      data.time_gen_decode     = t_decode.elapsed();
+      data.time_total_decode  += t_decode.elapsed();
+#endif
+   }
+   else
+   {
+#ifdef PROFILING
+#pragma omp parallel for reduction(+:sum_size_gen)
+#else
+#pragma omp parallel for
+#endif
+      for( int k = 0; k < nEval; k++ )
+      {
+         const int i = data.evaluation_list[k];
+
+         int allele = 0; data.num_constants[k] = 0;
+         data.size[k] = decode( descendentes->genome[i], &allele, data.program + (k * data.max_size_phenotype), data.constants + (k * data.max_size_phenotype), &data.num_constants[k], 0, data.initial_symbol );
+         if( !data.size[k] ) { data.num_constants[k] = 0; }
+         descendentes->length[i] = allele; // Alleles beyond this point are introns
+
+         if( data.fitness_cache )
+         {
+            data.evaluation_hash[k] = phenotype_hash( data.program + (k * data.max_size_phenotype), data.constants + (k * data.max_size_phenotype), data.size[k] );
+            data.evaluation_hit[k] = data.fitness_cache->Find( data.evaluation_hash[k], descendentes->fitness[i] );
+         }
+#ifdef PROFILING
+         sum_size_gen += data.size[k];
+         //if( max_size < data.size[i] ) max_size = data.size[i];
+#endif
+      }
+#ifdef PROFILING
+      data.time_gen_decode     = t_decode.elapsed();
+      data.time_total_decode  += t_decode.elapsed();
+#endif
+
+      /* The programs to be interpreted are packed back to back, so that only
+         the words actually used are handed to the interpreter (and copied to
+         the device). The ones found in the fitness cache already got their
+         fitness, so only the misses are kept. */
+      int nPacked = 0; long total_size = 0;
+      for( int k = 0; k < nEval; k++ )
+      {
+         if( data.fitness_cache && data.evaluation_hit[k] ) { data.cached_list[nCached++] = data.evaluation_list[k]; continue; }
+
+         data.packed_source[nPacked] = k;
+         data.offset[nPacked] = total_size;
+         total_size += data.size[k] + data.num_constants[k];
+         data.size[nPacked] = data.size[k];
+         data.num_constants[nPacked] = data.num_constants[k];
+         data.evaluation_list[nPacked] = data.evaluation_list[k];
+         if( data.fitness_cache ) { data.evaluation_hash[nPacked] = data.evaluation_hash[k]; }
+         nPacked++;
+      }
+      data.offset[nPacked] = total_size;
+      nEval = nPacked;
+
+      if( total_size > data.packed_capacity )
+      {
+         data.packed_capacity = std::max( total_size, 2 * data.packed_capacity );
+         if( data.staging )
+            acc_staging( data.packed_capacity, &data.packed_program, &data.offset, &data.size );
+         else
+         {
+            delete[] data.packed_program; data.packed_program = new Instruction[data.packed_capacity];
+         }
+      }
+
+#pragma omp parallel for reduction(max:depth)
+      for( int k = 0; k < nEval; k++ )
+      {
+         const int slot = data.packed_source[k];
+         memcpy( data.packed_program + data.offset[k], data.program + (slot * data.max_size_phenotype), data.size[k] * sizeof(Instruction) );
+         memcpy( data.packed_program + data.offset[k] + data.size[k], data.constants + (slot * data.max_size_phenotype), data.num_constants[k] * sizeof(float) );
+         if( data.parallel_version ) depth = std::max( depth, stack_depth( data.packed_program + data.offset[k], data.size[k] ) );
+      }
+   }
+
 #ifdef PROFILING
    //std::cout << sum_size_gen/(double)data.population_size << " " << max_size << std::endl;
    data.sum_size += sum_size_gen;
 #endif
 
    int index[data.best_size];
+   int nBest = std::min( data.best_size, nEval );
 
-   if( data.parallel_version )
+   if( nEval == 0 )
+   {
+      // Nothing to evaluate, but the islands still exchange individuals
+      ppi_send_individual( antecedentes );
+      *nImmigrants = ppi_receive_individual( antecedentes );
+   }
+   else if( data.parallel_version )
    {
-      acc_interpret( data.phenotype, data.ephemeral, data.size, 
+      acc_stack_depth( depth );
+      acc_interpret( data.device_decode ? NULL : data.packed_program, data.offset, data.size, 
 #ifdef PROFILING
       sum_size_gen, 
 #endif
-      descendentes->fitness, data.population_size, &ppi_send_individual, &ppi_receive_individual, antecedentes, nImmigrants, index, &data.best_size, 0, 0, ALPHA );
+      data.evaluation_fitness, nEval, &ppi_send_individual, &ppi_receive_individual, antecedentes, nImmigrants, index, &nBest, 0, 0, ALPHA );
+
+      // The staging memory may have been mapped again elsewhere
+      if( data.staging ) acc_staging( 0, &data.packed_program, &data.offset, &data.size );
    }
    else
    {
@@ -626,18 +1278,51 @@ unsigned long ppi_evaluate( Population* descendentes, Population* antecedentes,
        foreign islands will be put into the next population, which may sound
        strange, but it is the 'antecedentes' (in the swap operation,
        'antecedentes' will be made the next generation). */
-      *nImmigrants = ppi_receive_individual( antecedentes->genome );
+      *nImmigrants = ppi_receive_individual( antecedentes );
 
-      seq_interpret( data.phenotype, data.ephemeral, data.size, 
+      seq_interpret( data.packed_program, data.offset, data.size, 
 #ifdef PROFILING
       sum_size_gen, 
 #endif
-      descendentes->fitness, data.population_size, index, &data.best_size, 0, 0, ALPHA );
+      data.evaluation_fitness, nEval, index, &nBest, 0, 0, ALPHA );
+   }
+
+   // Scatters the fitnesses (and the indices of the best ones) back
+   for( int k = 0; k < nEval; k++ )
+   {
+      descendentes->fitness[data.evaluation_list[k]] = data.evaluation_fitness[k];
+   }
+   for( int i = 0; i < nBest; i++ ) { index[i] = data.evaluation_list[index[i]]; }
+
+   if( data.fitness_cache )
+   {
+#pragma omp parallel for
+      for( int k = 0; k < nEval; k++ )
+      {
+         data.fitness_cache->Insert( data.evaluation_hash[k], data.evaluation_fitness[k] );
+      }
+
+      /* The cached individuals also compete for the best ones, as their
+         fitnesses may come from a previous run (see -fcf). */
+      if( nCached > 0 )
+      {
+         std::vector<int> candidates( index, index + nBest );
+         candidates.insert( candidates.end(), data.cached_list, data.cached_list + nCached );
+
+         std::vector<float> errors( candidates.size() );
+         for( unsigned c = 0; c < candidates.size(); c++ ) { errors[c] = descendentes->fitness[candidates[c]]; }
+
+         nBest = std::min( data.best_size, (int) candidates.size() );
+         util::PickNBest( nBest, index, candidates.size(), &errors[0], &candidates[0] );
+      }
    }
 
+   /* NB: a neutral individual can't be strictly better than the current best
+      ones, as its fitness was already taken into account when its parent was
+      evaluated. */
    for( int i = 0; i < data.best_size; i++ )
    {
-      if( descendentes->fitness[index[i]] < data.best_individual.fitness[i] )
+      if( i < nBest && descendentes->fitness[index[i]] < data.best_individual.fitness[i] )
       {
          Server::stagnation = 0;
          ppi_clone( descendentes, index[i], &data.best_individual, i );
@@ -666,10 +1351,12 @@ void ppi_generate_population( Population* antecedentes, Population* descendentes
 #pragma omp parallel for
    for( int i = 0; i < data.population_size; ++i)
    {
-      for( int j = 0; j < data.number_of_bits; j++ )
+      // One call to the RNG fills an entire word (64 alleles) at once
+      for( int j = 0; j < data.number_of_words; j++ )
       {
-         antecedentes->genome[i][j] = (random_number() < 0.5) ? 1 : 0;
+         antecedentes->genome[i][j] = GetRNG()->Int();
       }
+      antecedentes->genome[i][data.number_of_words - 1] &= genome_tail_mask( data.number_of_bits );
    }
 
 #ifdef PROFILING
@@ -679,12 +1366,35 @@ void ppi_generate_population( Population* antecedentes, Population* descendentes
    ppi_evaluate( antecedentes, descendentes, nImmigrants );
 }
 
-void ppi_crossover( const GENOME_TYPE* father, const GENOME_TYPE* mother, GENOME_TYPE* offspring1, GENOME_TYPE* offspring2 )
+/* Marks the offspring 'idx' as neutral or not; a neutral offspring inherits
+   the fitness (and coding length) of its parent 'idx_parent'. */
+static inline void ppi_inherit( Population* offspring, int idx, const Population* parents, int idx_parent, bool neutral )
+{
+   offspring->neutral[idx] = neutral;
+   if( neutral )
+   {
+      offspring->fitness[idx] = parents->fitness[idx_parent];
+      offspring->length[idx] = parents->length[idx_parent];
+   }
+}
+
+void ppi_crossover( const Population* parents, int idx_father, int idx_mother, Population* offspring, int idx1, int idx2 )
 {
 #ifdef PROFILING
    util::Timer t_crossover;
 #endif
 
+   const GENOME_TYPE* father = parents->genome[idx_father];
+   const GENOME_TYPE* mother = parents->genome[idx_mother];
+   GENOME_TYPE* offspring1 = offspring->genome[idx1];
+   GENOME_TYPE* offspring2 = offspring->genome[idx2];
+
+   /* An offspring is neutral if it only received alleles from the other
+      parent beyond the coding alleles of the parent it was copied from (or if
+      both parents are actually the same genome). */
+   const bool same = parents->slot[idx_father] == parents->slot[idx_mother];
+   bool neutral1, neutral2;
+
    if (GetRNG()->Probability(TWOPOINT_CROSSOVER_PROBABILITY))
    {
       // Cruzamento de dois pontos
@@ -697,36 +1407,33 @@ void ppi_crossover( const GENOME_TYPE* father, const GENOME_TYPE* mother, GENOME
       int tmp;
       if( pontos[0] > pontos[1] ) { tmp = pontos[0]; pontos[0] = pontos[1]; pontos[1] = tmp; }
    
-      for( int i = 0; i < pontos[0]; ++i )
-      {
-         offspring1[i] = father[i];
-         offspring2[i] = mother[i];
-      }
-      for( int i = pontos[0]; i < pontos[1]; ++i )
-      {
-         offspring1[i] = mother[i];
-         offspring2[i] = father[i];
-      }
-      for( int i = pontos[1]; i < data.number_of_bits; ++i )
-      {
-         offspring1[i] = father[i];
-         offspring2[i] = mother[i];
-      }
+      /* Whole words are copied at once; only the words containing the
+         crossover points are masked. NB: 'offspring1' and 'offspring2' might
+         be the same genome, in which case 'offspring2' prevails. */
+      memcpy( offspring1, father, data.number_of_words * sizeof(GENOME_TYPE) );
+      genome_copy_range( offspring1, mother, pontos[0], pontos[1] );
+
+      memcpy( offspring2, mother, data.number_of_words * sizeof(GENOME_TYPE) );
+      genome_copy_range( offspring2, father, pontos[0], pontos[1] );
+
+      neutral1 = same || pontos[0] == pontos[1] || pontos[0] >= parents->length[idx_father];
+      neutral2 = same || pontos[0] == pontos[1] || pontos[0] >= parents->length[idx_mother];
    } else {
       // Cruzamento de um ponto
       int pontoDeCruzamento = (int)(random_number() * data.number_of_bits);
    
-      for( int i = 0; i < pontoDeCruzamento; ++i )
-      {
-         offspring1[i] = father[i];
-         offspring2[i] = mother[i];
-      }
-      for( int i = pontoDeCruzamento; i < data.number_of_bits; ++i )
-      {
-         offspring1[i] = mother[i];
-         offspring2[i] = father[i];
-      }
+      memcpy( offspring1, father, data.number_of_words * sizeof(GENOME_TYPE) );
+      genome_copy_range( offspring1, mother, pontoDeCruzamento, data.number_of_bits );
+
+      memcpy( offspring2, mother, data.number_of_words * sizeof(GENOME_TYPE) );
+      genome_copy_range( offspring2, father, pontoDeCruzamento, data.number_of_bits );
+
+      neutral1 = same || pontoDeCruzamento >= parents->length[idx_father];
+      neutral2 = same || pontoDeCruzamento >= parents->length[idx_mother];
    }
+
+   ppi_inherit( offspring, idx1, parents, idx_father, neutral1 );
+   ppi_inherit( offspring, idx2, parents, idx_mother, neutral2 );
 #ifdef PROFILING
    double elapsed = t_crossover.elapsed();
 #pragma omp atomic
@@ -736,7 +1443,7 @@ void ppi_crossover( const GENOME_TYPE* father, const GENOME_TYPE* mother, GENOME
 #endif
 }
 
-void ppi_mutation( GENOME_TYPE* genome )
+void ppi_mutation( Population* population, int idx )
 {
 #ifdef PROFILING
    util::Timer t_mutation;
@@ -749,17 +1456,28 @@ void ppi_mutation( GENOME_TYPE* genome )
 
    if (num_bits_mutated == 0) return; // lucky guy, no mutation for him...
 
+   // Copy-on-write: only now the genome is materialized, if it is shared
+   genome_unshare( population, idx );
+   GENOME_TYPE* genome = population->genome[idx];
+
+   /* A neutral individual stays neutral as long as all the changes fall
+      beyond its coding alleles */
+   const int length = population->length[idx];
+   bool neutral = population->neutral[idx];
+
    if (GetRNG()->Probability(BITFLIP_MUTATION_PROBABILITY))
    {
       //////////////////////////////////////////////////////////////////////////
       // Bit (allele) mutation
       //////////////////////////////////////////////////////////////////////////
 
-      /* Then, each position is selected at random and its value is swapped. */
+      /* Then, each position is selected at random and its value is swapped
+         (by XOR-ing the word with the bit's mask). */
       while( num_bits_mutated-- > 0 )
       {
          int bit = (int)(random_number() * data.number_of_bits);
-         genome[bit] = !genome[bit];
+         genome_flip( genome, bit );
+         neutral = neutral && bit >= length;
       }
    } else {
       //////////////////////////////////////////////////////////////////////////
@@ -803,9 +1521,12 @@ void ppi_mutation( GENOME_TYPE* genome )
          the genome? We need to handle this situation: */
       int end = std::min(int(start+number_of_bits_to_shrink), int(data.number_of_bits));
 
-      // Using memmove (overlapping) instead of a for-loop for efficiency
-      memmove(&genome[start], &genome[end], (data.number_of_bits-end)*sizeof(GENOME_TYPE));
+      // Bit-level memmove (overlapping), moving up to a word at a time
+      genome_move_down( genome, start, end, data.number_of_bits - end );
+      neutral = neutral && start >= length;
    }
+
+   population->neutral[idx] = neutral;
 #ifdef PROFILING
    double elapsed = t_mutation.elapsed();
 #pragma omp atomic
@@ -847,6 +1568,330 @@ void ppi_print_time( bool total )
 }
 #endif
 
+/* Breeds the offspring [first, end) out of the 'parents' (steps 5 to 16 of
+   the pseudo-code in ppi_evolve), two by two. */
+void ppi_breed( Population* antecedentes, Population* descendentes, int first, int end )
+{
+   // 5 (NB: the static schedule matches the first touch of the arena, see ppi_genome_pool_create)
+#pragma omp parallel for schedule(static)
+   for( int i = first; i < end; i += 2 )
+   {
+      // 6:
+      int idx_father = ppi_tournament( antecedentes->fitness );
+      int idx_mother = ppi_tournament( antecedentes->fitness );
+
+      // 7:
+      if( random_number() < data.crossover_rate )
+      {
+         // 8 e 9:
+         if( i < ( end - 1 ) )
+         {
+            genome_renew( descendentes, i ); genome_renew( descendentes, i + 1 );
+            ppi_crossover( antecedentes, idx_father, idx_mother, descendentes, i, i + 1 );
+         }
+         else 
+         {
+            genome_renew( descendentes, i );
+            ppi_crossover( antecedentes, idx_father, idx_mother, descendentes, i, i );
+         }
+      } // 10
+      else 
+      {
+         // 9 (the clones share their parents' genomes until written):
+         ppi_clone( antecedentes, idx_father, descendentes, i );
+         if( i < ( end - 1 ) )
+         {
+            ppi_clone( antecedentes, idx_mother, descendentes, i + 1 );
+         }
+      } // 10
+
+      // 11, 12, 13, 14 e 15:
+      ppi_mutation( descendentes, i );
+      if( i < ( end - 1 ) )
+      {
+         ppi_mutation( descendentes, i + 1 );
+      }
+   } // 16
+}
+
+/* Prints the best individual at the end of the generation 'geracao' (-v) */
+void ppi_report( int geracao )
+{
+   if (data.verbose)
+   {
+      if (Server::stagnation == 0 || geracao < 2) {
+         if (data.machine) { // Output meant to be consumed by scripts, not humans
+            ppi_print_best(stdout, geracao, 1);
+#ifdef PROFILING
+            ppi_print_time(false);
+#else
+            fprintf(stdout, "\n");
+#endif
+         } else
+            ppi_print_best(stdout, geracao, 0);
+
+      }
+      else std::cerr << '.';
+   }
+}
+
+/* Waits for the evaluation of the 'batch', whose offspring then replace the
+   corresponding individuals of 'antecedentes', and updates the best
+   individuals; tells whether any of them has improved. */
+bool ppi_complete_batch( Population* descendentes, Population* antecedentes, t_batch* batch, int b )
+{
+#ifdef PROFILING
+   util::Timer t_evaluate;
+#endif
+
+   int index[data.best_size];
+   int nBest = std::min( data.best_size, batch->nEval );
+
+   acc_wait( b, batch->fitness, batch->size, ALPHA, index, &nBest );
+
+   for( int k = 0; k < batch->nEval; k++ )
+   {
+      descendentes->fitness[batch->list[k]] = batch->fitness[k];
+   }
+   for( int i = 0; i < nBest; i++ ) { index[i] = batch->list[index[i]]; }
+
+   // The offspring take the place of the old individuals, which will be replaced when breeding this batch again
+   for( int i = batch->begin; i < batch->end; i++ )
+   {
+      GENOME_TYPE* genome = antecedentes->genome[i]; antecedentes->genome[i] = descendentes->genome[i]; descendentes->genome[i] = genome;
+      float fitness = antecedentes->fitness[i]; antecedentes->fitness[i] = descendentes->fitness[i]; descendentes->fitness[i] = fitness;
+      int slot = antecedentes->slot[i]; antecedentes->slot[i] = descendentes->slot[i]; descendentes->slot[i] = slot;
+      int length = antecedentes->length[i]; antecedentes->length[i] = descendentes->length[i]; descendentes->length[i] = length;
+      bool neutral = antecedentes->neutral[i]; antecedentes->neutral[i] = descendentes->neutral[i]; descendentes->neutral[i] = neutral;
+   }
+
+   bool improved = false;
+   for( int i = 0; i < nBest; i++ )
+   {
+      if( antecedentes->fitness[index[i]] < data.best_individual.fitness[i] )
+      {
+         improved = true;
+         ppi_clone( antecedentes, index[i], &data.best_individual, i );
+      }
+   }
+
+#ifdef PROFILING
+   data.time_gen_evaluate    += t_evaluate.elapsed();
+   data.time_total_evaluate  += t_evaluate.elapsed();
+#endif
+
+   return improved;
+}
+
+/* Pipelined (asynchronous steady-state) evolution, see -pl: the population
+   is bred in two halves (batches); while the device evaluates one of them
+   the host breeds and decodes the other one, whose parents are thus chosen
+   among the individuals evaluated so far (i.e., the other half still comes
+   from the previous generation). As soon as a batch is evaluated, its
+   offspring replace their half of the population. A generation is complete
+   when both halves are replaced. Returns the last generation (plus one),
+   just like the loop in ppi_evolve. */
+int ppi_evolve_pipelined( Population* antecedentes, Population* descendentes, int nImmigrants )
+{
+   const int half = data.population_size / 2;
+
+   t_batch batch[2];
+   ppi_batch_create( &batch[0], 0, half );
+   ppi_batch_create( &batch[1], half, data.population_size );
+
+   const int steps = 2 * data.generations;
+   int geracao = 1;
+   bool improved = false;
+
+#ifdef PROFILING
+   util::Timer t_gen_evolve;
+   data.time_gen_decode = data.time_gen_evaluate = 0.0;
+#endif
+
+   for( int s = 0; s <= steps; ++s )
+   {
+      /* Breeds (on the host) the batch 's' while the batch 's - 1' is still
+         being evaluated; the first half starts with the immigrants and the
+         elite individual, just like in ppi_evolve */
+      if( s < steps )
+      {
+         const int b = s % 2;
+         int first = batch[b].begin;
+         if( b == 0 )
+         {
+            if( s > 0 ) nImmigrants = ppi_receive_individual( descendentes );
+            first = std::min( nImmigrants, half );
+         }
+
+         for( int i = first; i < batch[b].end; ++i )
+         {
+            genome_release( descendentes->slot[i] );
+            descendentes->slot[i] = -1;
+         }
+         if( b == 0 && data.elitism && first < half )
+         {
+            ppi_clone( &data.best_individual, 0, descendentes, first );
+            first++;
+         }
+
+         ppi_breed( antecedentes, descendentes, first, batch[b].end );
+         ppi_submit_batch( descendentes, &batch[b], b );
+      }
+
+      if( s == 0 ) continue;
+
+      improved = ppi_complete_batch( descendentes, antecedentes, &batch[(s - 1) % 2], (s - 1) % 2 ) || improved;
+
+      if( (s - 1) % 2 == 1 ) // Both halves of the generation were replaced
+      {
+         if( improved ) Server::stagnation = 0; else Server::stagnation += data.best_size;
+         improved = false;
+
+         ppi_send_individual( antecedentes );
+
+         bool stop = Server::stagnation > data.stagnation_tolerance;
+         if( stop && s < steps )
+         {
+            // The batch just sent is not needed anymore, but it must be finished
+            int none = 0;
+            acc_wait( s % 2, batch[s % 2].fitness, batch[s % 2].size, ALPHA, NULL, &none );
+         }
+
+#ifdef PROFILING
+         data.time_gen_evolve    = t_gen_evolve.elapsed();
+         data.time_total_evolve += t_gen_evolve.elapsed();
+         t_gen_evolve.restart();
+#endif
+
+         ppi_report( geracao );
+
+#ifdef PROFILING
+         data.time_gen_decode = data.time_gen_evaluate = 0.0;
+#endif
+
+         ++geracao;
+         if( stop ) { geracao = data.generations + 1; break; }
+      }
+   }
+
+   ppi_batch_destroy( &batch[0] ); ppi_batch_destroy( &batch[1] );
+
+   return geracao;
+}
+
+/* Evaluates the current population of the device (see ppi_evolve_on_device),
+   does the migration (through the host 'mirror' of the population, if any)
+   and updates the best individuals; returns the stagnation, like ppi_evaluate. */
+unsigned long ppi_evaluate_on_device( Population* migrants, Population* mirror, int* nImmigrants )
+{
+#ifdef PROFILING
+   util::Timer t_evaluate;
+#endif
+
+   int nBest = data.best_size;
+   std::vector<int> index( data.best_size );
+
+   acc_evaluate( ALPHA, &index[0], &nBest );
+
+   if( mirror )
+   {
+      acc_fetch_population( mirror->genome, mirror->fitness );
+      ppi_send_individual( mirror );
+   }
+   *nImmigrants = ppi_receive_individual( migrants );
+
+   for( int i = 0; i < data.best_size; i++ )
+   {
+      float fitness = std::numeric_limits<float>::max(); int length;
+      if( i < nBest ) acc_fetch( index[i], NULL, &fitness, &length );
+
+      if( i < nBest && fitness < data.best_individual.fitness[i] )
+      {
+         Server::stagnation = 0;
+         acc_fetch( index[i], data.best_individual.genome[i], &data.best_individual.fitness[i], &data.best_individual.length[i] );
+      }
+      else
+      {
+         ++Server::stagnation;
+      }
+   }
+
+#ifdef PROFILING
+   data.time_gen_evaluate     = t_evaluate.elapsed();
+   data.time_total_evaluate  += t_evaluate.elapsed();
+#endif
+
+   return Server::stagnation;
+}
+
+/* The same evolution of ppi_evolve, but with the populations kept on the
+   device (see -de), which breeds, decodes and evaluates them; the host holds
+   only the best individuals, the immigrants and, when there are peers, a
+   mirror of the current population from which the emigrants are picked. */
+int ppi_evolve_on_device()
+{
+   const bool migration = !data.peers.empty();
+
+   ppi_genome_pool_create( data.immigrants_size + data.best_size + (migration ? data.population_size : 0) );
+
+   Population migrants, mirror;
+   ppi_population_create( &migrants, data.immigrants_size );
+   if( migration ) ppi_population_create( &mirror, data.population_size );
+
+   ppi_population_create( &data.best_individual, data.best_size );
+
+   // One XorShift128+ state per pair of offspring, seeded by the host's RNG
+   std::vector<uint64_t> seeds( 2 * ((data.population_size + 1) / 2) );
+   for( unsigned k = 0; k < seeds.size(); k += 2 ) { seeds[k] = GetRNG()->Int() | 1; seeds[k + 1] = GetRNG()->Int(); }
+
+   if( acc_evolve_init( data.number_of_bits, data.bits_per_gene, data.tournament_size, data.crossover_rate, data.mutation_rate, TWOPOINT_CROSSOVER_PROBABILITY, BITFLIP_MUTATION_PROBABILITY, AGGRESSIVE_SHRINK_MUTATION_PROBABILITY, &seeds[0] ) )
+   {
+      fprintf(stderr,"Error in initialization phase.\n");
+      return 0;
+   }
+
+   int nImmigrants;
+
+#ifdef PROFILING
+   util::Timer t_gen_evolve;
+#endif
+
+   acc_generate();
+   ppi_evaluate_on_device( &migrants, migration ? &mirror : NULL, &nImmigrants );
+
+#ifdef PROFILING
+   data.time_total_evolve = t_gen_evolve.elapsed();
+#endif
+
+   int geracao;
+   for( geracao = 1; geracao <= data.generations; ++geracao )
+   {
+#ifdef PROFILING
+      t_gen_evolve.restart();
+#endif
+
+      if( data.elitism )
+         acc_breed( nImmigrants, migrants.genome, data.best_individual.genome[0], data.best_individual.fitness[0], data.best_individual.length[0] );
+      else
+         acc_breed( nImmigrants, migrants.genome, NULL, 0.0f, 0 );
+
+      if (ppi_evaluate_on_device( &migrants, migration ? &mirror : NULL, &nImmigrants ) > data.stagnation_tolerance) geracao = data.generations;
+
+#ifdef PROFILING
+      data.time_gen_evolve    = t_gen_evolve.elapsed();
+      data.time_total_evolve += t_gen_evolve.elapsed();
+#endif
+
+      ppi_report( geracao );
+   }
+
+   // Clean up
+   ppi_population_destroy( &migrants, data.immigrants_size );
+   if( migration ) ppi_population_destroy( &mirror, data.population_size );
+
+   return geracao;
+}
+
 int ppi_evolve()
 {
    /* Initialize the RNG seed */
@@ -887,28 +1932,16 @@ int ppi_evolve()
    data.time_total_receive     = 0.0;
 #endif
    
+   if( data.device_evolution ) return ppi_evolve_on_device();
+
    Population antecedentes, descendentes;
 
-   antecedentes.fitness = new float[data.population_size];
-   descendentes.fitness = new float[data.population_size];
+   ppi_genome_pool_create( 2 * data.population_size + data.best_size );
 
-   antecedentes.genome = new GENOME_TYPE*[data.population_size];
-   descendentes.genome = new GENOME_TYPE*[data.population_size];
-#pragma omp parallel for
-   for (int i=0; i < data.population_size; ++i)
-   {
-      antecedentes.genome[i] = new GENOME_TYPE[data.number_of_bits];
-      descendentes.genome[i] = new GENOME_TYPE[data.number_of_bits];
-   }
+   ppi_population_create( &antecedentes, data.population_size );
+   ppi_population_create( &descendentes, data.population_size );
 
-
-   data.best_individual.fitness = new float[data.best_size];
-   data.best_individual.genome = new GENOME_TYPE*[data.best_size];
-   for( int i = 0; i < data.best_size; i++ )
-   {
-      data.best_individual.fitness[i] = std::numeric_limits<float>::max();
-      data.best_individual.genome[i] = new GENOME_TYPE[data.number_of_bits];
-   }
+   ppi_population_create( &data.best_individual, data.best_size );
 
    int nImmigrants;
 
@@ -924,9 +1957,9 @@ int ppi_evolve()
       data.time_total_evolve = t_gen_evolve.elapsed();
 #endif
 
-   // 3:
-   int geracao;
-   for( geracao = 1; geracao <= data.generations; ++geracao )
+   // 3 (unless pipelined, in which case the evolution is entirely done there):
+   int geracao = data.pipelined ? ppi_evolve_pipelined( &antecedentes, &descendentes, nImmigrants ) : 1;
+   for( ; geracao <= data.generations; ++geracao )
    {
 #ifdef PROFILING
       t_gen_evolve.restart();
@@ -937,6 +1970,15 @@ int ppi_evolve()
       data.time_gen_tournament = 0.0;
 #endif
 
+      /* The individuals of the previous generation that are about to be
+         replaced are dropped beforehand, so that no slot is given back to the
+         pool while breeding (see ppi_genome_pool_create). */
+      for( int i = nImmigrants; i < data.population_size; ++i )
+      {
+         genome_release( descendentes.slot[i] );
+         descendentes.slot[i] = -1;
+      }
+
       // 4:
       if( data.elitism ) 
       {
@@ -946,44 +1988,8 @@ int ppi_evolve()
 
       //std::cerr << "\nnImmigrants[generation: " << geracao << "]: " << nImmigrants << std::endl;
 
-      // 5
-#pragma omp parallel for
-      for( int i = nImmigrants; i < data.population_size; i += 2 )
-      {
-         // 6:
-         int idx_father = ppi_tournament( antecedentes.fitness );
-         int idx_mother = ppi_tournament( antecedentes.fitness );
-
-         // 7:
-         if( random_number() < data.crossover_rate )
-         {
-            // 8 e 9:
-            if( i < ( data.population_size - 1 ) )
-            {
-               ppi_crossover( antecedentes.genome[idx_father], antecedentes.genome[idx_mother], descendentes.genome[i], descendentes.genome[i + 1] );
-            }
-            else 
-            {
-               ppi_crossover( antecedentes.genome[idx_father], antecedentes.genome[idx_mother], descendentes.genome[i], descendentes.genome[i] );
-            }
-         } // 10
-         else 
-         {
-            // 9:
-            ppi_clone( &antecedentes, idx_father, &descendentes, i );
-            if( i < ( data.population_size - 1 ) )
-            {
-               ppi_clone( &antecedentes, idx_mother, &descendentes, i + 1 );
-            }
-         } // 10
-
-         // 11, 12, 13, 14 e 15:
-         ppi_mutation( descendentes.genome[i] );
-         if( i < ( data.population_size - 1 ) )
-         {
-            ppi_mutation( descendentes.genome[i + 1] );
-         }
-      } // 16
+      // 5 to 16:
+      ppi_breed( &antecedentes, &descendentes, nImmigrants, data.population_size );
 
       // 17:
       if (ppi_evaluate( &descendentes, &antecedentes, &nImmigrants ) > data.stagnation_tolerance) geracao = data.generations;
@@ -996,35 +2002,13 @@ int ppi_evolve()
       data.time_total_evolve += t_gen_evolve.elapsed();
 #endif
 
-      if (data.verbose)
-      {
-         if (Server::stagnation == 0 || geracao < 2) {
-            if (data.machine) { // Output meant to be consumed by scripts, not humans
-               ppi_print_best(stdout, geracao, 1);
-#ifdef PROFILING
-               ppi_print_time(false);
-#else
-               fprintf(stdout, "\n");
-#endif
-            } else
-               ppi_print_best(stdout, geracao, 0);
-
-         }
-         else std::cerr << '.';
-      }
+      ppi_report( geracao );
    } // 19
 
 
    // Clean up
-   for (int i=0; i < data.population_size; ++i)
-   {
-      delete[] antecedentes.genome[i];
-      delete[] descendentes.genome[i];
-   }
-   delete[] antecedentes.genome;
-   delete[] descendentes.genome;
-   delete[] antecedentes.fitness;
-   delete[] descendentes.fitness;
+   ppi_population_destroy( &antecedentes, data.population_size );
+   ppi_population_destroy( &descendentes, data.population_size );
 
    return geracao;
 }
@@ -1036,15 +2020,41 @@ void ppi_destroy()
    Poco::ThreadPool::defaultPool().stopAll();
    data.pool->threadpool.stopAll();
 
-   for( int i = 0; i < data.best_size; i++ )
+   ppi_population_destroy( &data.best_individual, data.best_size );
+   ppi_genome_pool_destroy();
+   delete[] data.program;
+   delete[] data.constants;
+   delete[] data.num_constants;
+   if( !data.staging ) // Otherwise they belong to the accelerator
    {
-      delete[] data.best_individual.genome[i];
+      delete[] data.size;
+      delete[] data.offset;
+      delete[] data.packed_program;
+   }
+   delete[] data.packed_source;
+   delete[] data.evaluation_genome;
+   delete[] data.evaluation_length;
+   delete[] data.evaluation_list;
+   delete[] data.evaluation_fitness;
+   if( data.chunk )
+   {
+      for( int c = 0; c < data.chunks; ++c ) ppi_batch_destroy( &data.chunk[c] );
+      delete[] data.chunk;
+   }
+
+   if( data.fitness_cache )
+   {
+      if( !data.fitness_cache_file.empty() && !data.fitness_cache->Save( data.fitness_cache_file.c_str(), data.fitness_cache_tag ) )
+      {
+         fprintf(stderr, "Could not save the fitness cache into '%s'.\n", data.fitness_cache_file.c_str());
+      }
+      if( data.verbose ) std::cerr << "\nFitness cache: " << data.fitness_cache->hits << " hits, " << data.fitness_cache->misses << " misses\n";
+
+      delete data.fitness_cache;
+      delete[] data.evaluation_hash;
+      delete[] data.evaluation_hit;
+      delete[] data.cached_list;
    }
-   delete[] data.best_individual.genome;
-   delete[] data.best_individual.fitness;
-   delete[] data.phenotype;
-   delete[] data.ephemeral;
-   delete[] data.size;
    delete[] Server::m_immigrants;
    delete[] Server::m_fitness;
    for (int i=0; i<GetMaxNumThreads(); ++i) delete data.RNGs[i]; delete[] data.RNGs;
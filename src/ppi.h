@@ -19,6 +19,7 @@
 
 #include "client/client.h"
 #include "Poco/ThreadPool.h"
+#include "util/Dataset.h"
 
 namespace ppi {
 
@@ -28,7 +29,7 @@ namespace ppi {
 /** ****************************************************************************************** **/
 /**                                                                                            **/
 /** ****************************************************************************************** **/
-void ppi_init( float** input, int nlin, int ncol, int argc, char** argv );
+void ppi_init( const util::Dataset& input, int argc, char** argv );
 
 /** ****************************************************************************************** **/
 /** ************************************* Function evolve ************************************ **/
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <cmath>    
 #include <string>   
+#include <cstring>
 #include "util/CmdLineParser.h"
 #include "interpreter/accelerator.h"
 #include "interpreter/sequential.h"
@@ -27,7 +28,7 @@
 /** ***************************** TYPES ****************************** **/
 /** ****************************************************************** **/
 
-namespace ppi { static struct t_data { int nlin; Symbol* phenotype; float* ephemeral; int* size; float* vector; int prediction; int parallel_version; } data; };
+namespace ppi { static struct t_data { int nlin; Instruction* program; int* offset; int* size; float* vector; int prediction; int parallel_version; } data; };
 
 /** ****************************************************************** **/
 /** ************************* MAIN FUNCTIONS ************************* **/
@@ -35,7 +36,7 @@ namespace ppi { static struct t_data { int nlin; Symbol* phenotype; float* ephem
 
 namespace ppi {
 
-void ppp_init( float** input, int nlin, int ncol, int argc, char** argv ) 
+void ppp_init( const util::Dataset& input, int argc, char** argv ) 
 {
    CmdLine::Parser Opts( argc, argv );
 
@@ -55,10 +56,10 @@ void ppp_init( float** input, int nlin, int ncol, int argc, char** argv )
    // Put the size of the solution (number of Symbols) into the variable data.size[0]
    iss >> data.size[0];
 
-   data.phenotype = new Symbol[data.size[0]];
-   data.ephemeral = new float[data.size[0]];
+   // The instructions followed by the constant pool (at most one constant per instruction)
+   data.program = new Instruction[2 * data.size[0]]();
 
-   int actual_size = 0; int tmp = -1;
+   int actual_size = 0; int tmp = -1; int num_constants = 0;
    for( int i = 0; i < data.size[0]; ++i )
    {
       iss >> tmp;
@@ -67,33 +68,45 @@ void ppp_init( float** input, int nlin, int ncol, int argc, char** argv )
       else
          break; // Stops if the actual number of Symbols is less than the informed
 
-      data.phenotype[i] = (Symbol)tmp;
-      if(
+      float value = 0.0f;
 #ifndef NOT_USING_T_CONST
-      data.phenotype[i] == T_CONST ||
+      if( (Symbol)tmp == T_CONST )
+      {
+         iss >> value;
+         memcpy( data.program + data.size[0] + num_constants, &value, sizeof(float) );
+         data.program[i] = INSTRUCTION( T_CONST, num_constants++ );
+      }
+      else
 #endif
-      data.phenotype[i] == T_ATTRIBUTE )
+      if( (Symbol)tmp == T_ATTRIBUTE )
       {
-         iss >> data.ephemeral[i];
+         iss >> value;
+         data.program[i] = INSTRUCTION( T_ATTRIBUTE, (int)value );
       }
+      else
+         data.program[i] = INSTRUCTION( tmp, 0 );
    }
 
    while (iss >> tmp) ++actual_size; // Let's check if there are still more Symbols remaining
    if (actual_size != data.size[0])
       std::cerr << "WARNING: The given size (" << data.size[0] << ") and actual size (" << actual_size << ") differ: '" << solution << "'\n";
 
-   data.nlin = nlin;
+   data.nlin = input.nlin;
+
+   // A single program, starting at the beginning of the buffer
+   data.offset = new int[2];
+   data.offset[0] = 0; data.offset[1] = data.size[0] + num_constants;
 
    if( data.parallel_version )
    {
-      if( acc_interpret_init( argc, argv, data.size[0], -1, 1, input, nlin, ncol, 1, data.prediction ) )
+      if( acc_interpret_init( argc, argv, data.size[0], -1, 1, input, 1, data.prediction ) )
       {
          fprintf(stderr,"Error in initialization phase.\n");
       }
    }
    else
    {
-      seq_interpret_init( data.size[0], input, nlin, ncol );
+      seq_interpret_init( data.size[0], input );
    }
 }
 
@@ -104,7 +117,7 @@ void ppp_interpret()
       data.vector = new float[data.nlin];
       if( data.parallel_version )
       {
-         acc_interpret( data.phenotype, data.ephemeral, data.size, 
+         acc_interpret( data.program, data.offset, data.size, 
 #ifdef PROFILING
          0,
 #endif
@@ -112,7 +125,7 @@ void ppp_interpret()
       }
       else
       {
-         seq_interpret( data.phenotype, data.ephemeral, data.size, 
+         seq_interpret( data.program, data.offset, data.size, 
 #ifdef PROFILING
          0,
 #endif
@@ -124,7 +137,7 @@ void ppp_interpret()
       data.vector = new float[1];
       if( data.parallel_version )
       {
-         acc_interpret( data.phenotype, data.ephemeral, data.size,
+         acc_interpret( data.program, data.offset, data.size,
 #ifdef PROFILING
          0,
 #endif
@@ -132,7 +145,7 @@ void ppp_interpret()
       }
       else
       {
-         seq_interpret( data.phenotype, data.ephemeral, data.size, 
+         seq_interpret( data.program, data.offset, data.size, 
 #ifdef PROFILING
          0,
 #endif
@@ -154,8 +167,8 @@ void ppp_print( FILE* out )
 
 void ppp_destroy() 
 {
-   delete[] data.phenotype;
-   delete[] data.ephemeral;
+   delete[] data.program;
+   delete[] data.offset;
    delete[] data.size;
    delete[] data.vector;
 
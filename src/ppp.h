@@ -16,6 +16,8 @@
 #ifndef ppp_h
 #define ppp_h
 
+#include "util/Dataset.h"
+
 namespace ppi {
 
 /** Funcoes exportadas **/
@@ -24,7 +26,7 @@ namespace ppi {
 /** ****************************************************************************************** **/
 /**                                                                                            **/
 /** ****************************************************************************************** **/
-void ppp_init( float** input, int nlin, int ncol, int argc, char **argv );
+void ppp_init( const util::Dataset& input, int argc, char **argv );
 
 /** ****************************************************************************************** **/
 /** ************************************* Function evolve ************************************ **/
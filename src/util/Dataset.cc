@@ -0,0 +1,140 @@
+// ---------------------------------------------------------------------------
+//
+//   Dataset.cc
+//
+//   Binary (memory-mapped) format of the datasets
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, see <http://www.gnu.org/licenses/>.
+//
+// ---------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Dataset.h"
+
+using namespace util;
+
+/* Header of the binary format; it is followed by zeros up to ALIGNMENT bytes,
+   so that the values (mapped right after it) start at a page boundary. */
+struct Header {
+   char magic[8];
+   int32_t nlin, ncol, stride, layout;
+   uint64_t bytes;        // Size of the values, padding included
+   uint64_t checksum;     // Checksum of the values
+   uint64_t source_size;  // Size and modification time of the source file
+   int64_t source_mtime;
+};
+
+static const char* Magic() { return "PPIDSv1"; }
+
+// ---------------------------------------------------------------------------
+void
+Dataset::Free()
+{
+   if( mapping ) munmap( mapping, mapping_bytes );
+   free( allocation );
+
+   values = NULL; mapping = NULL; mapping_bytes = 0; allocation = NULL;
+}
+
+// ---------------------------------------------------------------------------
+uint64_t
+Dataset::Checksum() const
+{
+   const uint64_t* words = (const uint64_t*) values;
+   const size_t n = Bytes() / sizeof(uint64_t);
+
+   uint64_t h = 0xCBF29CE484222325ULL;
+   for( size_t i = 0; i < n; ++i ) { h ^= words[i]; h *= 0x100000001B3ULL; }
+
+   return h;
+}
+
+// ---------------------------------------------------------------------------
+bool
+Dataset::Save( const char* filename, uint64_t source_size, int64_t source_mtime ) const
+{
+   FILE* f = fopen( filename, "wb" );
+   if( !f ) return false;
+
+   char block[ALIGNMENT]; memset( block, 0, sizeof(block) );
+   Header* header = (Header*) block;
+   memcpy( header->magic, Magic(), sizeof(header->magic) );
+   header->nlin = nlin; header->ncol = ncol; header->stride = stride; header->layout = layout;
+   header->bytes = Bytes();
+   header->checksum = Checksum();
+   header->source_size = source_size; header->source_mtime = source_mtime;
+
+   bool ok = fwrite( block, sizeof(block), 1, f ) == 1 && (Bytes() == 0 || fwrite( values, Bytes(), 1, f ) == 1);
+
+   return fclose( f ) == 0 && ok;
+}
+
+// ---------------------------------------------------------------------------
+int
+Dataset::Load( const char* filename, uint64_t* source_size, int64_t* source_mtime )
+{
+   int fd = open( filename, O_RDONLY );
+   if( fd < 0 ) return 1;
+
+   Header header; struct stat st;
+   if( fstat( fd, &st ) || pread( fd, &header, sizeof(header), 0 ) != (ssize_t) sizeof(header) ||
+       memcmp( header.magic, Magic(), sizeof(header.magic) ) || header.nlin < 0 || header.ncol <= 0 ||
+       (uint64_t) st.st_size != ALIGNMENT + header.bytes )
+   {
+      close( fd ); return 2;
+   }
+
+   /* The values are mapped privately (copy-on-write), so that the file is
+      never modified and the pages are shared by all the processes (islands)
+      that load the same dataset. */
+   void* p = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+   close( fd );
+   if( p == MAP_FAILED ) return 1;
+
+   Free();
+   mapping = p; mapping_bytes = st.st_size;
+   values = (float*) ((char*) p + ALIGNMENT);
+   nlin = header.nlin; ncol = header.ncol; stride = header.stride; layout = (Layout) header.layout;
+
+   if( (layout != COLUMN_MAJOR && layout != ROW_MAJOR) || stride != Stride( nlin, ncol, layout ) ||
+       Bytes() != header.bytes || Checksum() != header.checksum )
+   {
+      Free(); nlin = ncol = stride = 0;
+      return 2;
+   }
+
+   if( source_size ) *source_size = header.source_size;
+   if( source_mtime ) *source_mtime = header.source_mtime;
+
+   return 0;
+}
+
+// ---------------------------------------------------------------------------
+bool
+Dataset::IsBinary( const char* filename )
+{
+   FILE* f = fopen( filename, "rb" );
+   if( !f ) return false;
+
+   char magic[8];
+   bool binary = fread( magic, sizeof(magic), 1, f ) == 1 && !memcmp( magic, Magic(), sizeof(magic) );
+
+   fclose( f );
+   return binary;
+}
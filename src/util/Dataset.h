@@ -0,0 +1,173 @@
+// ---------------------------------------------------------------------------
+//
+//   Dataset.h
+//
+//   Contiguous, aligned storage of the training/testing points
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, see <http://www.gnu.org/licenses/>.
+//
+// ---------------------------------------------------------------------------
+
+#ifndef _dataset_h
+#define _dataset_h
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <cstring>
+#include <algorithm>
+
+/* Number of rows (floats) the columns are padded to a multiple of: a cache line
+ * and, by the way, the widest block of the sequential interpreter */
+#ifndef DATASET_PADDING
+#define DATASET_PADDING 16
+#endif
+
+// -----------------------------------------------------------------------------
+namespace util {
+// -----------------------------------------------------------------------------
+
+/**
+ * @brief Dataset of @c nlin points (rows) by @c ncol variables (columns), the
+ * last column being the target, stored in a single aligned block of floats.
+ *
+ * The values are stored either column by column (COLUMN_MAJOR, the default,
+ * which is what both the sequential interpreter and the transposed OpenCL
+ * kernels want) or row by row (ROW_MAJOR). In the column-major layout each
+ * column is padded with zeros to @c stride rows, a multiple of @c PADDING
+ * floats (one cache line), so that every column starts aligned and blocks of
+ * rows can be read past the end of the last one. The block itself is aligned
+ * to @c ALIGNMENT (a page) and its size is a multiple of a cache line, which
+ * allows the OpenCL runtimes to use it in place (CL_MEM_USE_HOST_PTR).
+ *
+ * The dataset is owned by @c main and shared (read-only) by everyone else.
+ *
+ * Besides being allocated (and then filled in), a dataset can be loaded from
+ * a binary file written by Save(), which is just mapped into memory (see
+ * Load()) and needs no parsing at all.
+ */
+class Dataset {
+public:
+   enum Layout { COLUMN_MAJOR, ROW_MAJOR };
+   enum { ALIGNMENT = 4096, PADDING = DATASET_PADDING };
+
+   Dataset(): values( NULL ), nlin( 0 ), ncol( 0 ), stride( 0 ), layout( COLUMN_MAJOR ), mapping( NULL ), mapping_bytes( 0 ), allocation( NULL ) {}
+   ~Dataset() { Free(); }
+
+   /** @brief Allocates (zeroed) room for @p nlin points of @p ncol variables.
+    *
+    * @return @p true on success; @p false otherwise
+    */
+   bool Allocate( int nlin, int ncol, Layout layout = COLUMN_MAJOR )
+   {
+      Free();
+
+      this->nlin = nlin; this->ncol = ncol; this->layout = layout;
+      stride = Stride( nlin, ncol, layout );
+
+      void* p;
+      if( posix_memalign( &p, ALIGNMENT, Bytes() ) ) { this->nlin = this->ncol = stride = 0; return false; }
+      allocation = p; values = (float*) p;
+      memset( values, 0, Bytes() );
+
+      return true;
+   }
+
+   /** @brief Releases the values (either allocated or mapped). */
+   void Free();
+
+   /** @brief Value of the variable @p j of the point @p i. */
+   float& operator()( int i, int j ) { return layout == COLUMN_MAJOR ? values[(size_t) j * stride + i] : values[(size_t) i * stride + j]; }
+   float operator()( int i, int j ) const { return layout == COLUMN_MAJOR ? values[(size_t) j * stride + i] : values[(size_t) i * stride + j]; }
+
+   /** @brief The (padded) column @p j; only for the COLUMN_MAJOR layout. */
+   const float* Column( int j ) const { return values + (size_t) j * stride; }
+
+   /** @brief Size in bytes of the whole block, padding included (always a
+    * multiple of a cache line). */
+   size_t Bytes() const
+   {
+      const size_t n = (size_t) stride * (layout == COLUMN_MAJOR ? ncol : nlin);
+      return (n + PADDING - 1) / PADDING * PADDING * sizeof(float);
+   }
+
+   /** @brief Copies this dataset into @p dst using the given @p layout.
+    *
+    * @return @p true on success; @p false otherwise
+    */
+   bool CopyTo( Dataset& dst, Layout layout ) const
+   {
+      if( !dst.Allocate( nlin, ncol, layout ) ) return false;
+
+      for( int j = 0; j < ncol; ++j )
+         for( int i = 0; i < nlin; ++i )
+            dst( i, j ) = (*this)( i, j );
+
+      return true;
+   }
+
+   /** @brief Exchanges the contents of this dataset with the ones of @p other. */
+   void Swap( Dataset& other )
+   {
+      std::swap( values, other.values ); std::swap( nlin, other.nlin ); std::swap( ncol, other.ncol );
+      std::swap( stride, other.stride ); std::swap( layout, other.layout );
+      std::swap( mapping, other.mapping ); std::swap( mapping_bytes, other.mapping_bytes ); std::swap( allocation, other.allocation );
+   }
+
+   /**
+    * @brief Saves the dataset in the binary format: a header of ALIGNMENT
+    * bytes followed by the values exactly as they are stored in memory.
+    *
+    * @p source_size and @p source_mtime identify the file (CSV) the dataset
+    * came from, if any, so that the saved file can be used as its cache.
+    *
+    * @return @p true on success; @p false otherwise
+    */
+   bool Save( const char* filename, uint64_t source_size = 0, int64_t source_mtime = 0 ) const;
+
+   /**
+    * @brief Maps the binary file @p filename (written by Save()) into memory;
+    * the values are used in place (copy-on-write), in the saved layout.
+    *
+    * @param[out] source_size, source_mtime the identification of the source
+    * file given to Save(), if not NULL
+    * @return 0 on success; 1 if the file could not be opened; 2 if it is not a
+    * valid dataset (wrong header or checksum)
+    */
+   int Load( const char* filename, uint64_t* source_size = NULL, int64_t* source_mtime = NULL );
+
+   /** @brief Tells whether @p filename starts with the header of a binary
+    * dataset. */
+   static bool IsBinary( const char* filename );
+
+   /** @brief Checksum of the values (64-bit FNV-1a over the words). */
+   uint64_t Checksum() const;
+
+   float* values;
+   int nlin, ncol, stride;
+   Layout layout;
+
+private:
+   static int Stride( int nlin, int ncol, Layout layout ) { return layout == COLUMN_MAJOR ? (nlin + PADDING - 1) / PADDING * PADDING : ncol; }
+
+   void* mapping; size_t mapping_bytes; // Whole file mapped by Load(), if any
+   void* allocation;                    // Memory allocated by Allocate(), if any
+
+   Dataset( const Dataset& );
+   Dataset& operator=( const Dataset& );
+};
+
+// -----------------------------------------------------------------------------
+} // end namespace util
+// -----------------------------------------------------------------------------
+#endif
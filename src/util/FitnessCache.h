@@ -0,0 +1,239 @@
+// ---------------------------------------------------------------------------
+//
+//   FitnessCache.h
+//
+//   Bounded, concurrent cache of fitness values keyed by a 64-bit hash
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, see <http://www.gnu.org/licenses/>.
+//
+// ---------------------------------------------------------------------------
+
+#ifndef _fitness_cache_h
+#define _fitness_cache_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <cstring>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// -----------------------------------------------------------------------------
+namespace util {
+// -----------------------------------------------------------------------------
+
+/**
+ * @brief Set-associative cache that maps 64-bit keys (hashes) into fitness
+ * values, with LRU replacement within each set.
+ *
+ * The cache is made of sets of @c WAYS entries (128 bytes); a key can
+ * only live in the set given by its lower bits, so a lookup touches a single
+ * set. When a set is full the least recently used entry is replaced. Sets are
+ * protected by a fixed number of (striped) locks, so that Find() and Insert()
+ * can be called concurrently from several threads.
+ *
+ * Note that only the hash is stored, not the actual key; collisions of the
+ * 64-bit hash are deemed as improbable enough to be ignored.
+ */
+class FitnessCache {
+public:
+   enum { WAYS = 8, LOCKS = 64 };
+
+   /** @brief Creates a cache holding at least @p capacity entries. */
+   FitnessCache( unsigned long capacity ): hits( 0 ), misses( 0 )
+   {
+      num_sets = 1;
+      while( num_sets * WAYS < capacity ) num_sets <<= 1;
+
+      sets = new Set[num_sets];
+      memset( sets, 0, num_sets * sizeof( Set ) );
+#ifdef _OPENMP
+      for( int i = 0; i < LOCKS; ++i ) omp_init_lock( &locks[i] );
+#endif
+   }
+
+   ~FitnessCache()
+   {
+#ifdef _OPENMP
+      for( int i = 0; i < LOCKS; ++i ) omp_destroy_lock( &locks[i] );
+#endif
+      delete[] sets;
+   }
+
+   /** @brief Mixes the value @p v into the hash @p h (64-bit finalizer of
+    * SplitMix64). */
+   static uint64_t Hash( uint64_t h, uint64_t v )
+   {
+      h += v + 0x9E3779B97F4A7C15ULL;
+      h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+      return h ^ (h >> 31);
+   }
+
+   /**
+    * @brief Looks up @p key.
+    *
+    * @param[out] fitness the cached fitness, if found
+    * @return @p true on hit; @p false otherwise
+    */
+   bool Find( uint64_t key, float& fitness )
+   {
+      key = Valid( key );
+      Set& set = sets[key & (num_sets - 1)];
+
+      Lock( key );
+      for( int w = 0; w < WAYS; ++w )
+         if( set.key[w] == key )
+         {
+            set.stamp[w] = ++set.clock;
+            fitness = set.fitness[w];
+            Unlock( key );
+#pragma omp atomic
+            ++hits;
+            return true;
+         }
+      Unlock( key );
+
+#pragma omp atomic
+      ++misses;
+      return false;
+   }
+
+   /** @brief Inserts (or refreshes) @p key, evicting the least recently used
+    * entry of its set if needed. */
+   void Insert( uint64_t key, float fitness )
+   {
+      key = Valid( key );
+      Set& set = sets[key & (num_sets - 1)];
+
+      Lock( key );
+      int victim = 0;
+      for( int w = 0; w < WAYS; ++w )
+      {
+         if( set.key[w] == key || set.key[w] == 0 ) { victim = w; break; }
+         if( Age( set, w ) > Age( set, victim ) ) victim = w;
+      }
+      set.key[victim] = key;
+      set.fitness[victim] = fitness;
+      set.stamp[victim] = ++set.clock;
+      Unlock( key );
+   }
+
+   /**
+    * @brief Loads the entries saved by Save().
+    *
+    * The file is only accepted if it was saved with the same @p tag, which
+    * should identify everything the fitness depends on besides the program
+    * itself (dataset, error function, etc.).
+    *
+    * @return the number of entries loaded, or -1 if the file could not be
+    * read or does not match @p tag
+    */
+   long Load( const char* filename, uint64_t tag )
+   {
+      FILE* f = fopen( filename, "rb" );
+      if( !f ) return -1;
+
+      char magic[8]; uint64_t file_tag, count;
+      if( fread( magic, sizeof(magic), 1, f ) != 1 || memcmp( magic, Magic(), sizeof(magic) ) ||
+          fread( &file_tag, sizeof(file_tag), 1, f ) != 1 || file_tag != tag ||
+          fread( &count, sizeof(count), 1, f ) != 1 )
+      {
+         fclose( f ); return -1;
+      }
+
+      long loaded = 0; uint64_t key; float fitness;
+      while( count-- > 0 && fread( &key, sizeof(key), 1, f ) == 1 && fread( &fitness, sizeof(fitness), 1, f ) == 1 )
+      {
+         Insert( key, fitness ); ++loaded;
+      }
+
+      fclose( f );
+      return loaded;
+   }
+
+   /** @brief Saves all the entries, tagged with @p tag (see Load()).
+    *
+    * The entries are written into a temporary file ('filename'.pid) that then
+    * replaces @p filename, so that other processes (islands) never load a
+    * partial file and a failed save keeps the previous one.
+    *
+    * @return @p true on success; @p false otherwise
+    */
+   bool Save( const char* filename, uint64_t tag ) const
+   {
+      char tmp[4096];
+      if( snprintf( tmp, sizeof(tmp), "%s.%ld", filename, (long) getpid() ) >= (int) sizeof(tmp) ) return false;
+
+      FILE* f = fopen( tmp, "wb" );
+      if( !f ) return false;
+
+      uint64_t count = 0;
+      for( unsigned long s = 0; s < num_sets; ++s )
+         for( int w = 0; w < WAYS; ++w ) if( sets[s].key[w] ) ++count;
+
+      bool ok = fwrite( Magic(), 8, 1, f ) == 1 && fwrite( &tag, sizeof(tag), 1, f ) == 1 &&
+                fwrite( &count, sizeof(count), 1, f ) == 1;
+
+      for( unsigned long s = 0; ok && s < num_sets; ++s )
+         for( int w = 0; ok && w < WAYS; ++w )
+            if( sets[s].key[w] )
+               ok = fwrite( &sets[s].key[w], sizeof(uint64_t), 1, f ) == 1 && fwrite( &sets[s].fitness[w], sizeof(float), 1, f ) == 1;
+
+      if( fclose( f ) == 0 && ok && rename( tmp, filename ) == 0 ) return true;
+
+      unlink( tmp );
+      return false;
+   }
+
+   unsigned long Capacity() const { return num_sets * WAYS; }
+
+   unsigned long hits, misses;
+
+private:
+   /* Structure-of-arrays set: the keys are scanned first, so they are kept
+      together in the first cache line. */
+   struct Set { uint64_t key[WAYS]; float fitness[WAYS]; uint16_t stamp[WAYS]; uint16_t clock; uint16_t pad[7]; };
+
+   /* Age of an entry (the 16-bit clock may wrap around, hence the unsigned
+      difference) */
+   static uint16_t Age( const Set& set, int w ) { return (uint16_t) (set.clock - set.stamp[w]); }
+
+   static const char* Magic() { return "PPIFCv1"; }
+
+   // The key 0 marks an empty entry
+   static uint64_t Valid( uint64_t key ) { return key ? key : 1; }
+
+#ifdef _OPENMP
+   void Lock( uint64_t key )   { omp_set_lock( &locks[(key & (num_sets - 1)) % LOCKS] ); }
+   void Unlock( uint64_t key ) { omp_unset_lock( &locks[(key & (num_sets - 1)) % LOCKS] ); }
+
+   omp_lock_t locks[LOCKS];
+#else
+   void Lock( uint64_t ) {}
+   void Unlock( uint64_t ) {}
+#endif
+
+   Set* sets;
+   unsigned long num_sets;
+
+   FitnessCache( const FitnessCache& );
+   FitnessCache& operator=( const FitnessCache& );
+};
+
+// -----------------------------------------------------------------------------
+} // end namespace util
+// -----------------------------------------------------------------------------
+#endif
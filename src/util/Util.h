@@ -29,7 +29,9 @@
 #include <sstream>
 #include <cstring>
 #include <cmath>
-#include <queue>
+#include <vector>
+#include <algorithm>
+#include <functional>
 
 // -----------------------------------------------------------------------------
 namespace util {
@@ -157,18 +159,22 @@ inline unsigned NextPowerOf2( unsigned n )
 
 void inline PickNBest(int n, int *best, int num_individuals, float *errors, int *indices = 0)
 {
-   /* This reduction makes use of a priority queue in order to sort the individuals
-      according to their errors so that the first ones in the queue are the best. */
-   std::priority_queue<std::pair<float, int> > q;
+   /* The individuals are ranked by their errors, the first ones being the best;
+      only the first 'n' need to be sorted (the rest is just partitioned). */
+   if( n > num_individuals ) n = num_individuals;
+   if( n <= 0 ) return;
+   std::vector<std::pair<float, int> > q( num_individuals );
    for( int i = 0; i < num_individuals; ++i ) 
    {
-      q.push( std::pair<float, int>(errors[i]*(-1.0f), i) ); // multiply by -1 so that the ones with less errors are the first ones
+      q[i] = std::pair<float, int>(errors[i]*(-1.0f), i); // multiply by -1 so that the ones with less errors are the first ones
    }
+   std::greater<std::pair<float, int> > first;
+   if( n < num_individuals ) std::nth_element( q.begin(), q.begin() + n, q.end(), first );
+   std::sort( q.begin(), q.begin() + n, first );
    for( int i = 0; i < n; ++i ) // pick first the top (best) individuals
    {
-      // If a mapping is given through 'indices' then use it instead of the sole index provided by q.top().second
-      best[i] = indices ? indices[q.top().second] : q.top().second;
-      q.pop();
+      // If a mapping is given through 'indices' then use it instead of the sole index provided by q[i].second
+      best[i] = indices ? indices[q[i].second] : q[i].second;
    }
 }
 